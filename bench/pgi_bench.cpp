@@ -0,0 +1,310 @@
+#include <pgi.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pgi;
+
+struct BenchRow
+{
+    time_point_t time;
+    double a;
+    double b;
+    double c;
+};
+PGI_ROW(BenchRow, time, a, b, c)
+
+namespace {
+
+const std::string values_table = "public.pgi_bench_values";
+const std::string timed_table = "public.pgi_bench_timed";
+const std::string mixed_table = "public.pgi_bench_mixed";
+
+const char* usage =
+    "Usage: pgi_bench [options]\n"
+    "  --config FILE       connection file (default " PGI_BENCH_CONFIG ")\n"
+    "  --threads LIST      comma separated thread counts (default 1,2,4,8)\n"
+    "  --batches LIST      comma separated batch sizes of the bulk cases (default 1,10,100,1000)\n"
+    "  --operations N      operations per thread and case (default 100)\n"
+    "  --filter TEXT       only run the cases whose name contains TEXT\n"
+    "  --json FILE         also write the results as JSON\n"
+    "  --metrics           print the DatabaseWorker metrics in Prometheus format at the end\n";
+
+struct Options
+{
+    std::string config = PGI_BENCH_CONFIG;
+    std::vector<std::size_t> threads{1, 2, 4, 8};
+    std::vector<std::size_t> batches{1, 10, 100, 1000};
+    std::size_t operations = 100;
+    std::string filter;
+    std::string json;
+    bool metrics = false;
+};
+
+struct Result
+{
+    std::string name;
+    std::size_t threads;
+    std::size_t batch;
+    std::size_t operations;
+    std::size_t rows;
+    double seconds;
+    std::uint64_t p50;
+    std::uint64_t p99;
+    std::uint64_t max;
+};
+
+std::vector<std::size_t> parse_list(const std::string& str)
+{
+    std::vector<std::size_t> values;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        values.push_back(std::stoul(item));
+    return values;
+}
+
+/// Runs op(thread, iteration) operations times on each of threads threads. op returns the number of rows it handled.
+template <typename F>
+Result run(const std::string& name, std::size_t threads, std::size_t batch, std::size_t operations, F&& op)
+{
+    LatencyHistogram latency;
+    std::atomic<std::size_t> rows{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t] {
+            for (std::size_t i = 0; i < operations; i++)
+            {
+                auto op_start = std::chrono::steady_clock::now();
+                std::size_t n = op(t, i);
+                latency.record(std::uint64_t(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - op_start)
+                        .count()));
+                rows += n;
+            }
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    return Result{name,
+        threads,
+        batch,
+        threads * operations,
+        rows.load(),
+        seconds.count(),
+        latency.percentile(0.5),
+        latency.percentile(0.99),
+        latency.max()};
+}
+
+void report(const Result& r, std::ostream& out)
+{
+    out << std::left << std::setw(24) << r.name << " threads " << std::setw(3) << r.threads << " batch "
+        << std::setw(6) << r.batch << std::right << std::setw(12) << std::fixed << std::setprecision(0)
+        << double(r.rows) / r.seconds << " rows/s   p50 " << std::setw(9) << std::setprecision(1)
+        << double(r.p50) * 1e-3 << " us   p99 " << std::setw(9) << double(r.p99) * 1e-3 << " us" << std::endl;
+    out.unsetf(std::ios::floatfield);
+}
+
+void write_json(const std::string& path, const Options& options, const std::vector<Result>& results)
+{
+    std::ofstream out(path);
+    out << "{\n  \"context\": {\"operations_per_thread\": " << options.operations << "},\n  \"benchmarks\": [";
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        out << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "/batch:" << r.batch << "/threads:" << r.threads
+            << "\", \"case\": \"" << r.name << "\", \"threads\": " << r.threads << ", \"batch\": " << r.batch
+            << ", \"operations\": " << r.operations << ", \"rows\": " << r.rows << ", \"real_time_s\": " << r.seconds
+            << ", \"rows_per_second\": " << double(r.rows) / r.seconds << ", \"p50_ns\": " << r.p50
+            << ", \"p99_ns\": " << r.p99 << ", \"max_ns\": " << r.max << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+/// Stream buffer discarding its output, stateless so that several threads can write to it.
+struct NullBuffer : std::streambuf
+{
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+/// Columns of mixed_table holding n rows starting at value first.
+struct MixedColumns
+{
+    std::map<std::string, std::vector<double>> doubles;
+    std::map<std::string, std::vector<std::string>> strings;
+    std::map<std::string, std::vector<time_point_t>> times;
+
+    MixedColumns(std::size_t n, std::size_t first)
+    {
+        time_point_t now = std::chrono::system_clock::now();
+        for (std::size_t i = 0; i < n; i++)
+        {
+            doubles["a"].push_back(double(first + i));
+            doubles["b"].push_back(0.5 * double(i));
+            doubles["c"].push_back(-1.5);
+            strings["label"].push_back("row " + std::to_string(first + i));
+            times["time"].push_back(now - std::chrono::seconds(i));
+        }
+    }
+};
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--config" && i + 1 < argc)
+            options.config = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc)
+            options.threads = parse_list(argv[++i]);
+        else if (arg == "--batches" && i + 1 < argc)
+            options.batches = parse_list(argv[++i]);
+        else if (arg == "--operations" && i + 1 < argc)
+            options.operations = std::stoul(argv[++i]);
+        else if (arg == "--filter" && i + 1 < argc)
+            options.filter = argv[++i];
+        else if (arg == "--json" && i + 1 < argc)
+            options.json = argv[++i];
+        else if (arg == "--metrics")
+            options.metrics = true;
+        else
+        {
+            std::cerr << usage;
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    DatabaseWorker dbw(options.config);
+    if (options.metrics)
+        dbw.enable_metrics();
+    dbw.execute("CREATE TABLE IF NOT EXISTS " + values_table +
+                " (a double precision, b double precision, c double precision)");
+    dbw.execute("CREATE TABLE IF NOT EXISTS " + timed_table +
+                " (time timestamp without time zone NOT NULL, a double precision, b double precision,"
+                " c double precision)");
+    dbw.execute("CREATE TABLE IF NOT EXISTS " + mixed_table +
+                " (a double precision, b double precision, c double precision,"
+                " time timestamp without time zone NOT NULL, label varchar(100))");
+
+    std::vector<Result> results;
+    std::streambuf* cout_buffer = std::cout.rdbuf();
+    auto bench = [&](const std::string& name, const std::string& table, bool batched, auto&& op) {
+        if (name.find(options.filter) == std::string::npos)
+            return;
+        for (std::size_t batch : batched ? options.batches : std::vector<std::size_t>{1})
+        {
+            for (std::size_t threads : options.threads)
+            {
+                if (!table.empty())
+                    dbw.clear(table);
+                results.push_back(run(name, threads, batch, options.operations,
+                    [&](std::size_t t, std::size_t i) { return op(batch, t * options.operations + i); }));
+                report(results.back(), std::cout.rdbuf() == cout_buffer ? std::cout : std::cerr);
+            }
+        }
+    };
+
+    bench("insert/values", values_table, false, [&](std::size_t, std::size_t i) {
+        dbw.insert(values_table, double(i), 2.0, 3.0);
+        return std::size_t(1);
+    });
+    bench("insert/literals", timed_table, false, [&](std::size_t, std::size_t i) {
+        dbw.insert(timed_table, "NOW()", double(i), 2.0, 3.0);
+        return std::size_t(1);
+    });
+    bench("insert/vector", values_table, false, [&](std::size_t, std::size_t i) {
+        dbw.insert(values_table, std::vector<double>{double(i), 2.0, 3.0});
+        return std::size_t(1);
+    });
+    bench("insert/timed_vector", timed_table, false, [&](std::size_t, std::size_t i) {
+        dbw.insert(timed_table, std::chrono::system_clock::now(), std::vector<double>{double(i), 2.0, 3.0});
+        return std::size_t(1);
+    });
+    bench("insert/rows", timed_table, true, [&](std::size_t batch, std::size_t i) {
+        std::vector<BenchRow> rows(batch, BenchRow{std::chrono::system_clock::now(), double(i), 2.0, 3.0});
+        dbw.insert(timed_table, rows);
+        return batch;
+    });
+    bench("insert_from_maps", mixed_table, false, [&](std::size_t, std::size_t i) {
+        std::map<std::string, double> doubles{{"a", double(i)}, {"b", 2.0}, {"c", 3.0}};
+        std::map<std::string, std::string> strings{{"label", "row " + std::to_string(i)}};
+        std::map<std::string, time_point_t> times{{"time", std::chrono::system_clock::now()}};
+        dbw.insert_from_maps(mixed_table, doubles, strings, times);
+        return std::size_t(1);
+    });
+    dbw.flush();
+    bench("bulk_insert_from_maps", mixed_table, true, [&](std::size_t batch, std::size_t i) {
+        MixedColumns columns(batch, i * batch);
+        dbw.bulk_insert_from_maps(mixed_table, columns.doubles, columns.strings, columns.times);
+        return batch;
+    });
+    bench("bulk_copy_from_maps", mixed_table, true, [&](std::size_t batch, std::size_t i) {
+        MixedColumns columns(batch, i * batch);
+        dbw.bulk_copy_from_maps(mixed_table, columns.doubles, columns.strings, columns.times);
+        return batch;
+    });
+
+    // Tables read and updated by the following cases
+    std::size_t max_batch = *std::max_element(options.batches.begin(), options.batches.end());
+    std::size_t max_threads = *std::max_element(options.threads.begin(), options.threads.end());
+    std::size_t filled = std::max(max_batch, options.operations * max_threads);
+    dbw.clear(mixed_table);
+    MixedColumns fill(filled, 0);
+    dbw.bulk_copy_from_maps(mixed_table, fill.doubles, fill.strings, fill.times);
+
+    bench("update_from_maps", "", false, [&](std::size_t, std::size_t i) {
+        std::map<std::string, double> doubles{{"b", double(i) * 0.1}};
+        dbw.update_from_maps(mixed_table, "a = " + std::to_string(i % filled), doubles);
+        return std::size_t(1);
+    });
+    bench("bulk_update_from_maps", "", true, [&](std::size_t batch, std::size_t i) {
+        std::map<std::string, std::vector<double>> doubles;
+        for (std::size_t j = 0; j < batch; j++)
+        {
+            doubles["a"].push_back(double((i * batch + j) % filled));
+            doubles["b"].push_back(double(j) * 0.1);
+        }
+        dbw.bulk_update_from_maps(mixed_table, "a", doubles);
+        return batch;
+    });
+    // batch rows are selected under a limit they do not reach, which would print a warning
+    auto first_rows = [](std::size_t batch) { return "a < " + std::to_string(batch); };
+    bench("select", "", true, [&](std::size_t batch, std::size_t) {
+        return std::size_t(std::size(dbw.select(mixed_table, {}, first_rows(batch), "", int(batch) + 1)));
+    });
+
+    // Printed rows are discarded, results are reported on std::cerr meanwhile
+    NullBuffer null_buffer;
+    std::vector<pqxx::result> printed;
+    for (std::size_t batch : options.batches)
+        printed.push_back(dbw.select(mixed_table, {}, first_rows(batch), "", int(batch) + 1));
+    std::cout.rdbuf(&null_buffer);
+    bench("print", "", true, [&](std::size_t batch, std::size_t) {
+        const pqxx::result& r = printed[std::find(options.batches.begin(), options.batches.end(), batch) -
+                                        options.batches.begin()];
+        dbw.print(r);
+        return std::size_t(std::size(r));
+    });
+    std::cout.rdbuf(cout_buffer);
+
+    if (!options.json.empty())
+        write_json(options.json, options, results);
+    if (options.metrics)
+        std::cout << dbw.metrics()->prometheus();
+    return 0;
+}
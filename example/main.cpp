@@ -3,6 +3,7 @@
 #include <pgi.hpp>
 #include "config_dir.hpp"
 #include <chrono>
+#include <cstdlib>
 #include <execution>
 using namespace pgi;
 
@@ -44,6 +45,13 @@ int main()
     dbw.insert_from_maps("public.test_table3", double_cols, string_cols, time_cols);
     dbw.insert_from_maps("public.test_table3", double_cols, string_cols, time_cols);
 
+    // A key in several maps takes the value of the first map having it
+    std::map<std::string, double> first_cols;
+    first_cols["test_double1"] = 7.5;
+    dbw.insert_from_maps("public.test_table3", first_cols, double_cols, string_cols, time_cols);
+    if (dbw.select("public.test_table3", {"test_double2"}, "test_double1 = 7.5").empty())
+        return 1;
+
     // Bulk insert of row
     std::map<std::string, std::vector<double>> double_cols_bulk;
     double_cols_bulk["test_double1"] = {1.1, 1.2, 1.3};
@@ -56,6 +64,9 @@ int main()
     time_cols_bulk["time2"] = {tp, tp - 5s, tp - 10s};
     dbw.bulk_insert_from_maps("public.test_table3", double_cols_bulk, string_cols_bulk, time_cols_bulk);
 
+    // Same rows, streamed through COPY
+    dbw.bulk_copy_from_maps("public.test_table3", double_cols_bulk, string_cols_bulk, time_cols_bulk);
+
     // Test concurrency
     std::vector<int> vecint(5, 1);
 
@@ -65,5 +76,25 @@ int main()
         });
     dbw.print("public.test_table3");
 
+    // Tables unknown to a worker holding a single connection, explored by the transaction and the pipeline using it
+    DatabaseWorker single(pgi_test::pgi_config_dir + "database_config_single.yaml");
+    Transaction transaction = single.begin();
+    transaction.insert("public.test_table2", 1.5, 2.5, 3.5);
+    transaction.select("public.test_table2", columns2);
+    if (!transaction.commit())
+        return 1;
+    Pipeline pipeline = single.pipeline();
+    Pipeline::query_id id = pipeline.select("public.test_table", columns);
+    pipeline.retrieve(id);
+    if (!pipeline.commit())
+        return 1;
+
+    // UTC offsets with seconds (local mean time, +00:19:32 in Amsterdam in 1900) are written and read back whole
+    setenv("TZ", "Europe/Amsterdam", 1);
+    tzset();
+    time_point_t lmt = utl::parse_timestamp("1900-06-01 12:00:00+00:00");
+    if (utl::ISO_8601(lmt) != "1900-06-01 12:19:32.000000+00:19:32" || utl::parse_timestamp(utl::ISO_8601(lmt)) != lmt)
+        return 1;
+
     return 0;
 }
\ No newline at end of file
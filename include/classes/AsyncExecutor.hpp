@@ -0,0 +1,318 @@
+#pragma once
+#include <libpq-fe.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <charconv>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace pgi {
+
+/// Result of a statement run by AsyncExecutor. Values are given in text format.
+class AsyncResult
+{
+public:
+    AsyncResult() = default;
+    explicit AsyncResult(PGresult* res) : res_(res, PQclear) {}
+
+    int size() const { return res_ ? PQntuples(res_.get()) : 0; }
+    int columns() const { return res_ ? PQnfields(res_.get()) : 0; }
+    std::string_view column_name(int col) const { return PQfname(res_.get(), col); }
+    bool is_null(int row, int col) const { return PQgetisnull(res_.get(), row, col) == 1; }
+    std::string_view get(int row, int col) const
+    {
+        return std::string_view(PQgetvalue(res_.get(), row, col), PQgetlength(res_.get(), row, col));
+    }
+
+    /// Number of rows inserted, updated or deleted by the statement.
+    std::size_t affected_rows() const
+    {
+        std::size_t count = 0;
+        if (res_)
+        {
+            std::string_view tuples = PQcmdTuples(res_.get());
+            std::from_chars(tuples.data(), tuples.data() + tuples.size(), count);
+        }
+        return count;
+    }
+
+    const PGresult* raw() const { return res_.get(); }
+
+private:
+    std::shared_ptr<PGresult> res_;
+};
+
+/// Runs statements on its own non-blocking libpq connections without blocking the calling threads.
+/// A single background thread sends the queued statements to the idle connections (PQsendQuery), then waits on
+/// the sockets of all of them at once with poll() and reads the results as they arrive (PQconsumeInput), so many
+/// statements are in flight at the same time with one thread. Completion callbacks run on that thread and must
+/// not block: post to the caller's event loop (e.g. asio::post) or use the future returning overload.
+/// COPY statements are not supported. The destructor waits for every queued statement.
+class AsyncExecutor
+{
+public:
+    /// Called with the result of the statement and an empty error, or with the error message of the failure.
+    using callback_t = std::function<void(AsyncResult&&, const std::string& error)>;
+
+    AsyncExecutor(const std::string& connection_string, std::size_t size)
+    {
+        if (pipe(wake_pipe_) != 0)
+            throw std::runtime_error("AsyncExecutor: cannot create its wake-up pipe");
+        fcntl(wake_pipe_[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake_pipe_[1], F_SETFL, O_NONBLOCK);
+
+        slots_.resize(size > 0 ? size : 1);
+        for (Slot& slot : slots_)
+        {
+            slot.connection = PQconnectdb(connection_string.c_str());
+            if (PQstatus(slot.connection) != CONNECTION_OK)
+            {
+                std::string error = PQerrorMessage(slot.connection);
+                close();
+                throw std::runtime_error("AsyncExecutor: connection failed: " + error);
+            }
+            PQsetnonblocking(slot.connection, 1);
+        }
+        thread_ = std::thread(&AsyncExecutor::run, this);
+    }
+
+    AsyncExecutor(const AsyncExecutor&) = delete;
+    AsyncExecutor& operator=(const AsyncExecutor&) = delete;
+
+    ~AsyncExecutor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake();
+        thread_.join();
+        close();
+    }
+
+    /// Queues a statement, done is called once it completed.
+    void execute(std::string statement, callback_t done)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(Task{std::move(statement), std::move(done)});
+            pending_++;
+        }
+        wake();
+    }
+
+    /// Queues a statement. The future throws std::runtime_error if it failed.
+    std::future<AsyncResult> execute(std::string statement)
+    {
+        auto promise = std::make_shared<std::promise<AsyncResult>>();
+        std::future<AsyncResult> future = promise->get_future();
+        execute(std::move(statement), [promise](AsyncResult&& r, const std::string& error) {
+            if (error.empty())
+                promise->set_value(std::move(r));
+            else
+                promise->set_exception(std::make_exception_ptr(std::runtime_error(error)));
+        });
+        return future;
+    }
+
+    std::size_t size() const { return slots_.size(); }
+
+    /// Number of statements queued or running.
+    std::size_t pending() const { return pending_.load(); }
+
+private:
+    struct Task
+    {
+        std::string statement;
+        callback_t done;
+    };
+
+    struct Slot
+    {
+        PGconn* connection = nullptr;
+        bool busy = false;
+        bool flushing = false;
+        Task task;
+        AsyncResult result;
+        std::string error;
+    };
+
+    void run()
+    {
+        std::vector<pollfd> fds;
+        std::vector<Slot*> polled;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                for (Slot& slot : slots_)
+                {
+                    if (tasks_.empty())
+                        break;
+                    if (slot.busy)
+                        continue;
+                    slot.task = std::move(tasks_.front());
+                    tasks_.pop_front();
+                    lock.unlock();
+                    send(slot);
+                    lock.lock();
+                }
+                if (stop_ && pending_.load() == 0)
+                    return;
+            }
+
+            fds.assign(1, pollfd{wake_pipe_[0], POLLIN, 0});
+            polled.clear();
+            for (Slot& slot : slots_)
+            {
+                if (!slot.busy)
+                    continue;
+                short events = POLLIN;
+                if (slot.flushing)
+                    events |= POLLOUT;
+                fds.push_back(pollfd{PQsocket(slot.connection), events, 0});
+                polled.push_back(&slot);
+            }
+
+            if (poll(fds.data(), fds.size(), -1) < 0)
+                continue;
+
+            if (fds[0].revents & POLLIN)
+            {
+                char drain[64];
+                while (read(wake_pipe_[0], drain, sizeof(drain)) > 0)
+                {
+                }
+            }
+            for (std::size_t i = 0; i < polled.size(); i++)
+                if (fds[i + 1].revents)
+                    receive(*polled[i], fds[i + 1].revents);
+        }
+    }
+
+    void send(Slot& slot)
+    {
+        if (!PQsendQuery(slot.connection, slot.task.statement.c_str()))
+        {
+            slot.busy = true;
+            fail(slot);
+            return;
+        }
+        slot.busy = true;
+        slot.flushing = false;
+        int flushed = PQflush(slot.connection);
+        if (flushed < 0)
+            fail(slot);
+        else
+            slot.flushing = flushed == 1;
+    }
+
+    void receive(Slot& slot, short revents)
+    {
+        if (slot.flushing && (revents & (POLLOUT | POLLIN)))
+        {
+            int flushed = PQflush(slot.connection);
+            if (flushed < 0)
+                return fail(slot);
+            slot.flushing = flushed == 1;
+        }
+        if (!(revents & (POLLIN | POLLERR | POLLHUP)))
+            return;
+        if (!PQconsumeInput(slot.connection))
+            return fail(slot);
+
+        while (!PQisBusy(slot.connection))
+        {
+            PGresult* res = PQgetResult(slot.connection);
+            if (!res)
+                return complete(slot);
+            ExecStatusType status = PQresultStatus(res);
+            if (status == PGRES_COPY_IN)
+            {
+                PQclear(res);
+                PQputCopyEnd(slot.connection, "COPY is not supported by AsyncExecutor");
+                continue;
+            }
+            if ((status == PGRES_FATAL_ERROR || status == PGRES_BAD_RESPONSE) && slot.error.empty())
+                slot.error = PQresultErrorMessage(res);
+            slot.result = AsyncResult(res);
+        }
+    }
+
+    /// Reports a connection level failure, resetting the connection if it was lost.
+    void fail(Slot& slot)
+    {
+        if (slot.error.empty())
+            slot.error = PQerrorMessage(slot.connection);
+        if (PQstatus(slot.connection) == CONNECTION_BAD)
+        {
+            PQreset(slot.connection);
+            PQsetnonblocking(slot.connection, 1);
+        }
+        else
+        {
+            // Discard what is left of the failed statement
+            while (PGresult* res = PQgetResult(slot.connection))
+                PQclear(res);
+        }
+        complete(slot);
+    }
+
+    void complete(Slot& slot)
+    {
+        Task task = std::move(slot.task);
+        AsyncResult result = std::move(slot.result);
+        std::string error = std::move(slot.error);
+        slot.error.clear();
+        slot.busy = false;
+        slot.flushing = false;
+        try
+        {
+            task.done(std::move(result), error);
+        } catch (const std::exception& e)
+        {
+            std::cerr << "\nError : " << e.what() << "was raised by the completion of the following statement : \n"
+                      << task.statement << '\n';
+        }
+        pending_--;
+    }
+
+    void wake()
+    {
+        if (write(wake_pipe_[1], "", 1) < 0)
+        {
+            // The pipe is full: the background thread is already due to wake up
+        }
+    }
+
+    void close()
+    {
+        for (Slot& slot : slots_)
+            if (slot.connection)
+                PQfinish(slot.connection);
+        slots_.clear();
+        ::close(wake_pipe_[0]);
+        ::close(wake_pipe_[1]);
+    }
+
+    std::vector<Slot> slots_;
+    std::deque<Task> tasks_;
+    std::mutex mutex_;
+    bool stop_ = false;
+    std::atomic<std::size_t> pending_{0};
+    int wake_pipe_[2] = {-1, -1};
+    std::thread thread_;
+};
+
+}  // namespace pgi
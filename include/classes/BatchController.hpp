@@ -0,0 +1,191 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "classes/Metrics.hpp"
+
+namespace pgi {
+
+/// What a BatchController tunes the batches toward.
+enum class BatchGoal
+{
+    latency,    ///< Largest batches whose p99 commit latency stays under AdaptiveBatchOptions::target_latency.
+    throughput  ///< Batch size maximising the rows committed per second of commit.
+};
+
+struct AdaptiveBatchOptions
+{
+    bool enabled = false;
+    BatchGoal goal = BatchGoal::latency;
+    /// p99 commit latency aimed at by BatchGoal::latency.
+    std::chrono::milliseconds target_latency{50};
+    std::size_t min_batch = 10;
+    std::size_t max_batch = 50000;
+    std::chrono::milliseconds min_interval{5};
+    std::chrono::milliseconds max_interval{1000};
+    /// Number of writes of a table measured before each adjustment.
+    std::size_t window = 16;
+};
+
+/// Tunes the batch size and the flush interval of each table from the measured duration of its writes.
+/// Every window writes the batch size is adjusted: with BatchGoal::latency it is halved when the p99 commit latency
+/// of the window exceeds the target and grown by a quarter when it is below three quarters of it (backing off
+/// fast, probing slowly); with BatchGoal::throughput it keeps moving by a factor 1.5 in the direction that raised
+/// the rows committed per second of commit, and turns back otherwise. The flush interval follows as the time the
+/// observed arrival rate takes to fill a batch. Decisions are published to the Metrics given, if any.
+/// Called by the write-behind flusher, the decisions may be read from any thread.
+class BatchController
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    BatchController(AdaptiveBatchOptions options,
+        std::size_t batch_size,
+        std::chrono::milliseconds flush_interval,
+        std::shared_ptr<Metrics> metrics = nullptr)
+        : options_(options), metrics_(metrics)
+    {
+        options_.min_batch = std::max<std::size_t>(options_.min_batch, 1);
+        options_.max_batch = std::max(options_.max_batch, options_.min_batch);
+        options_.max_interval = std::max(options_.max_interval, options_.min_interval);
+        options_.window = std::max<std::size_t>(options_.window, 1);
+        initial_batch_ = std::clamp(batch_size, options_.min_batch, options_.max_batch);
+        initial_interval_ = std::clamp(flush_interval, options_.min_interval, options_.max_interval);
+    }
+
+    BatchController(const BatchController&) = delete;
+    BatchController& operator=(const BatchController&) = delete;
+
+    /// Number of queued rows of a table that triggers its write.
+    std::size_t batch_size(const std::string& table)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return state(table).decision.batch_size;
+    }
+
+    /// Maximum time a queued row of a table waits before being written.
+    std::chrono::milliseconds flush_interval(const std::string& table)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return state(table).decision.flush_interval;
+    }
+
+    /// Smallest batch size of the tables, the number of queued rows worth waking the flusher for.
+    std::size_t min_batch_size() const
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        std::size_t size = initial_batch_;
+        for (auto const& [table, s] : tables_)
+            size = std::min(size, s.decision.batch_size);
+        return size;
+    }
+
+    /// Records a committed write of rows of a table, adjusting its decisions at the end of each window.
+    void record(const std::string& table, std::size_t rows, std::chrono::nanoseconds duration)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        State& s = state(table);
+        if (s.durations.empty())
+            s.window_start = s.last_write;
+        s.durations.push_back(duration);
+        s.rows += rows;
+        s.last_write = clock::now();
+        if (s.durations.size() >= options_.window)
+            adjust(s);
+    }
+
+    /// Current decisions of every table written so far.
+    std::vector<BatchDecision> decisions() const
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        std::vector<BatchDecision> decisions;
+        for (auto const& [table, s] : tables_)
+            decisions.push_back(s.decision);
+        return decisions;
+    }
+
+private:
+    struct State
+    {
+        BatchDecision decision;
+        std::vector<std::chrono::nanoseconds> durations;
+        std::size_t rows = 0;
+        clock::time_point window_start;
+        clock::time_point last_write;
+        double last_throughput = 0;
+        /// Direction of the last throughput move, 1 to grow or -1 to shrink.
+        int direction = 1;
+    };
+
+    State& state(const std::string& table)
+    {
+        auto it = tables_.find(table);
+        if (it != tables_.end())
+            return it->second;
+        State& s = tables_[table];
+        s.decision.table = table;
+        s.decision.batch_size = initial_batch_;
+        s.decision.flush_interval = initial_interval_;
+        s.last_write = clock::now();
+        return s;
+    }
+
+    void adjust(State& s)
+    {
+        std::size_t n = s.durations.size();
+        auto p99 = s.durations.begin() + std::ptrdiff_t((n * 99 + 99) / 100 - 1);
+        std::nth_element(s.durations.begin(), p99, s.durations.end());
+        std::chrono::nanoseconds busy(0);
+        for (std::chrono::nanoseconds d : s.durations)
+            busy += d;
+        double elapsed = std::chrono::duration<double>(s.last_write - s.window_start).count();
+
+        BatchDecision& d = s.decision;
+        d.p99_commit = std::chrono::duration_cast<std::chrono::microseconds>(*p99);
+        d.rows_per_second = busy.count() > 0 ? double(s.rows) * 1e9 / double(busy.count()) : 0;
+        d.arrival_rate = elapsed > 0 ? double(s.rows) / elapsed : 0;
+        // Growing batches that the interval flushes half empty would not change their size
+        bool filled = s.rows * 2 >= n * d.batch_size;
+
+        double size = double(d.batch_size);
+        if (options_.goal == BatchGoal::latency)
+        {
+            if (*p99 > options_.target_latency)
+                size /= 2;
+            else if (*p99 * 4 < options_.target_latency * 3 && filled)
+                size *= 1.25;
+        }
+        else
+        {
+            if (d.rows_per_second < s.last_throughput || (!filled && s.direction > 0))
+                s.direction = -s.direction;
+            size = s.direction > 0 ? size * 1.5 : size / 1.5;
+            s.last_throughput = d.rows_per_second;
+        }
+        d.batch_size = std::clamp(std::size_t(size + 0.5), options_.min_batch, options_.max_batch);
+        std::chrono::milliseconds fill = d.arrival_rate > 0
+            ? std::chrono::milliseconds(std::int64_t(1000 * double(d.batch_size) / d.arrival_rate))
+            : options_.max_interval;
+        d.flush_interval = std::clamp(fill, options_.min_interval, options_.max_interval);
+        d.adjustments++;
+
+        s.durations.clear();
+        s.rows = 0;
+        if (metrics_)
+            metrics_->batch_decision(d);
+    }
+
+    AdaptiveBatchOptions options_;
+    std::shared_ptr<Metrics> metrics_;
+    std::size_t initial_batch_;
+    std::chrono::milliseconds initial_interval_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, State> tables_;
+};
+
+}  // namespace pgi
@@ -0,0 +1,324 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace pgi {
+
+/// Name and SQL definition of a statement prepared on demand on pooled connections.
+struct PreparedStatement
+{
+    std::string name;
+    std::string definition;
+    /// Column type of each parameter, 0 when unknown. Lets time points be bound in binary (see utl::append_param).
+    std::vector<pqxx::oid> param_types;
+
+    /// Returns a process-wide unique statement name. Names stay short since the server truncates them to 63 bytes.
+    static std::string next_name()
+    {
+        static std::atomic<unsigned long> counter{0};
+        return "pgi_" + std::to_string(counter++);
+    }
+};
+
+/// Health check and reconnection settings of a ConnectionPool.
+struct PoolOptions
+{
+    /// Interval between two liveness checks of the idle connections, 0 to disable them.
+    std::chrono::milliseconds health_interval{10000};
+    /// Delay before reopening a lost connection, doubled after each failed attempt up to max_backoff.
+    std::chrono::milliseconds min_backoff{100};
+    std::chrono::milliseconds max_backoff{10000};
+    /// Number of times ConnectionPool::run retries work interrupted by a lost connection.
+    std::size_t retries = 1;
+};
+
+/// Fixed size pool of connections opened from the same connection string.
+/// Connections are borrowed through a Lease which gives them back to the pool when it goes out of scope.
+/// A connection found lost, when given back or by the background liveness check of idle connections, is
+/// reopened with an exponential backoff while callers keep using the other connections.
+class ConnectionPool
+{
+public:
+    /// RAII handle on a borrowed connection.
+    class Lease
+    {
+    public:
+        Lease(ConnectionPool* pool, std::size_t index) : pool_(pool), index_(index) {}
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease(Lease&& other) noexcept : pool_(other.pool_), index_(other.index_) { other.pool_ = nullptr; }
+        Lease& operator=(Lease&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                pool_ = other.pool_;
+                index_ = other.index_;
+                other.pool_ = nullptr;
+            }
+            return *this;
+        }
+        ~Lease() { release(); }
+
+        pqxx::connection& operator*() const { return *pool_->slots_[index_].connection; }
+        pqxx::connection* operator->() const { return pool_->slots_[index_].connection.get(); }
+
+        /// Prepares a statement on the borrowed connection unless it was already prepared on it.
+        void prepare(const PreparedStatement& statement)
+        {
+            Slot& slot = pool_->slots_[index_];
+            if (slot.prepared.count(statement.name))
+                return;
+            slot.connection->prepare(statement.name, statement.definition);
+            slot.prepared.insert(statement.name);
+        }
+
+        /// Index of the borrowed connection inside the pool.
+        std::size_t index() const { return index_; }
+
+    private:
+        void release()
+        {
+            if (pool_)
+                pool_->release(index_);
+            pool_ = nullptr;
+        }
+
+        ConnectionPool* pool_;
+        std::size_t index_;
+    };
+
+    /// Opens `size` connections (at least one). Connections that cannot be established are reported on
+    /// std::cerr and opened again later, when borrowed or by the liveness check.
+    ConnectionPool(const std::string& connection_string, std::size_t size, const PoolOptions& options = PoolOptions())
+        : connection_string_(connection_string), options_(options)
+    {
+        size = std::max<std::size_t>(size, 1);
+        slots_.resize(size);
+        free_.reserve(size);
+        for (std::size_t i = 0; i < size; i++)
+        {
+            open(slots_[i]);
+            free_.push_back(i);
+        }
+        if (options_.health_interval.count() > 0)
+            health_thread_ = std::thread(&ConnectionPool::check_health, this);
+    }
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    ~ConnectionPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stopping_ = true;
+        }
+        health_wake_.notify_one();
+        if (health_thread_.joinable())
+            health_thread_.join();
+    }
+
+    /// Borrows a free open connection, waiting until one is given back if they are all in use.
+    /// When only lost connections are free, reopens one whose backoff elapsed; throws pqxx::broken_connection if
+    /// that fails or if every connection of the pool is lost and waiting for its backoff.
+    Lease acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            available_.wait(lock, [this] { return !free_.empty(); });
+            auto open_slot = std::find_if(
+                free_.rbegin(), free_.rend(), [this](std::size_t i) { return bool(slots_[i].connection); });
+            if (open_slot != free_.rend())
+            {
+                std::size_t index = *open_slot;
+                free_.erase(std::next(open_slot).base());
+                return Lease(this, index);
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            auto due = std::min_element(free_.begin(), free_.end(),
+                [this](std::size_t a, std::size_t b) { return slots_[a].retry_at < slots_[b].retry_at; });
+            Slot& slot = slots_[*due];
+            if (slot.retry_at <= now)
+            {
+                std::size_t index = *due;
+                free_.erase(due);
+                lock.unlock();
+                Lease lease(this, index);
+                if (!open(slot))
+                    throw pqxx::broken_connection(slot.error);
+                return lease;
+            }
+            if (free_.size() == slots_.size())
+                throw pqxx::broken_connection(slot.error);
+            // Some connections are in use: wait for one of them, or for the backoff of a lost one
+            available_.wait_until(lock, slot.retry_at);
+        }
+    }
+
+    /// Runs f(lease) on a borrowed connection. If the connection is lost before the outcome of f is known
+    /// (pqxx::broken_connection), f runs again on another connection, up to options.retries times, so f must
+    /// only have effects through its own transaction. A commit of unknown outcome (pqxx::in_doubt_error) is never
+    /// run again.
+    template <typename F>
+    void run(F&& f)
+    {
+        for (std::size_t attempt = 0;; attempt++)
+        {
+            try
+            {
+                Lease lease = acquire();
+                f(lease);
+                return;
+            } catch (const pqxx::broken_connection& e)
+            {
+                if (attempt >= options_.retries)
+                    throw;
+                std::cerr << "\nWarning : " << e.what() << "was raised, retrying on another connection\n";
+            }
+        }
+    }
+
+    std::size_t size() const { return slots_.size(); }
+
+    /// Number of borrowed connections.
+    std::size_t in_use() const
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return slots_.size() - free_.size();
+    }
+
+    /// Number of connections currently lost.
+    std::size_t lost() const
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return lost_;
+    }
+
+private:
+    /// A connection and the names of the statements already prepared on it. A lost connection is null.
+    struct Slot
+    {
+        std::unique_ptr<pqxx::connection> connection;
+        std::unordered_set<std::string> prepared;
+        std::chrono::steady_clock::time_point retry_at;
+        std::chrono::milliseconds backoff{0};
+        std::string error;
+        bool lost = false;
+    };
+
+    /// (Re)opens the connection of a slot that is not in the free list. Returns false, scheduling the next
+    /// attempt, if it failed.
+    bool open(Slot& slot)
+    {
+        try
+        {
+            slot.connection.reset(new pqxx::connection(connection_string_));
+            slot.backoff = std::chrono::milliseconds(0);
+            set_lost(slot, false);
+            return true;
+        } catch (const std::exception& e)
+        {
+            slot.connection.reset();
+            slot.error = e.what();
+            slot.backoff = std::min(options_.max_backoff, std::max(options_.min_backoff, slot.backoff * 2));
+            slot.retry_at = std::chrono::steady_clock::now() + slot.backoff;
+            set_lost(slot, true);
+            std::cerr << e.what() << '\n';
+            return false;
+        }
+    }
+
+    /// Drops the connection of a slot once it is found broken, so that it is reopened.
+    void drop(Slot& slot)
+    {
+        slot.connection.reset();
+        slot.prepared.clear();
+        slot.error = "connection lost";
+        slot.retry_at = std::chrono::steady_clock::now();
+        set_lost(slot, true);
+    }
+
+    void set_lost(Slot& slot, bool lost)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (lost != slot.lost)
+            lost ? lost_++ : lost_--;
+        slot.lost = lost;
+    }
+
+    void release(std::size_t index)
+    {
+        Slot& slot = slots_[index];
+        if (slot.connection && !slot.connection->is_open())
+            drop(slot);
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            free_.push_back(index);
+        }
+        available_.notify_one();
+    }
+
+    /// Background liveness check: borrows each idle connection in turn, runs SELECT 1 on it, and reopens the
+    /// lost ones whose backoff elapsed.
+    void check_health()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_)
+        {
+            health_wake_.wait_for(lock, options_.health_interval, [this] { return stopping_; });
+            for (std::size_t index = 0; index < slots_.size() && !stopping_; index++)
+            {
+                auto it = std::find(free_.begin(), free_.end(), index);
+                if (it == free_.end())
+                    continue;
+                Slot& slot = slots_[index];
+                if (!slot.connection && slot.retry_at > std::chrono::steady_clock::now())
+                    continue;
+                free_.erase(it);
+                lock.unlock();
+                {
+                    Lease lease(this, index);
+                    if (!slot.connection)
+                        open(slot);
+                    else
+                    {
+                        try
+                        {
+                            pqxx::nontransaction(*slot.connection).exec("SELECT 1");
+                        } catch (const std::exception& e)
+                        {
+                            std::cerr << "\nError : " << e.what() << "was raised by a connection liveness check\n";
+                            drop(slot);
+                        }
+                    }
+                }
+                lock.lock();
+            }
+        }
+    }
+
+    std::string connection_string_;
+    PoolOptions options_;
+    std::vector<Slot> slots_;
+    std::vector<std::size_t> free_;
+    std::size_t lost_ = 0;
+    bool stopping_ = false;
+    mutable std::mutex mutex_;
+    std::condition_variable available_;
+    std::condition_variable health_wake_;
+    std::thread health_thread_;
+};
+
+}  // namespace pgi
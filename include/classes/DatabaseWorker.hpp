@@ -4,32 +4,86 @@
 #include "utl/string_utls.hpp"
 #include "utl/datetime.hpp"
 #include "utl/map_utls.hpp"
+#include "utl/copy_utls.hpp"
+#include "utl/decode_utls.hpp"
+#include "utl/sql_buffer.hpp"
+#include "utl/row_traits.hpp"
+#include "classes/ConnectionPool.hpp"
+#include "classes/TableSchema.hpp"
+#include "classes/SchemaRegistry.hpp"
+#include "classes/WriteBehindQueue.hpp"
+#include "classes/AsyncExecutor.hpp"
+#include "classes/NotificationListener.hpp"
+#include "classes/ReplicationStream.hpp"
+#include "classes/Metrics.hpp"
+#include "classes/ResultCache.hpp"
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <iomanip>
 #include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace pgi {
 
+class Pipeline;
+class Transaction;
+
 class DatabaseWorker
 {
 public:
     /// Constructor requires a connection file and optionnaly a configuration file defining the tables to explore.
+    /// The number of pooled connections is read from meta/open_connections in the connection file (1 if absent),
+    /// their health checks and reconnections from meta/health_interval_ms and meta/retries, see PoolOptions.
+    /// Servers listed under replicas: get their own pools, serving select, select_stream and select_batches (and so
+    /// select_columns, select_all_columns and print) while every other statement runs on the connection: server.
     DatabaseWorker(const std::string& connection_file, std::string configuration_file = "")
     {
         // Step 1 : Connection
         YAML::Node connection_config_root = YAML::LoadFile(connection_file);
         YAML::Node connection_config = connection_config_root["connection"];
-        connect(connection_config);
+        std::size_t open_connections = 1;
+        if (connection_config_root["meta"] && connection_config_root["meta"]["open_connections"])
+            open_connections = connection_config_root["meta"]["open_connections"].as<std::size_t>();
+        connect(connection_config, open_connections, pool_options(connection_config_root["meta"]));
+        if (connection_config_root["replicas"])
+        {
+            YAML::Node meta = connection_config_root["meta"];
+            std::size_t replica_connections = open_connections;
+            if (meta && meta["replica_connections"])
+                replica_connections = meta["replica_connections"].as<std::size_t>();
+            if (meta && meta["read_balancing"])
+                round_robin_reads_ = meta["read_balancing"].as<std::string>() == "round_robin";
+            connect_replicas(
+                connection_config, connection_config_root["replicas"], replica_connections, pool_options(meta));
+        }
+        if (connection_config_root["meta"] && connection_config_root["meta"]["metrics"] &&
+            connection_config_root["meta"]["metrics"].as<bool>())
+            enable_metrics();
+        if (connection_config_root["meta"] && connection_config_root["meta"]["write_behind"])
+            enable_write_behind(write_behind_options(connection_config_root["meta"]["write_behind"]));
+        if (connection_config_root["meta"] && connection_config_root["meta"]["result_cache"])
+            enable_result_cache(result_cache_options(connection_config_root["meta"]["result_cache"]));
+        if (connection_config_root["meta"] && connection_config_root["meta"]["async_connections"])
+            enable_async(connection_config_root["meta"]["async_connections"].as<std::size_t>());
 
         // Step 2 (optionnal): Explore tables
         if (configuration_file.empty())
             configuration_file = connection_file;
         db_config_ = YAML::LoadFile(configuration_file);
+        load_field_widths();
         if (db_config_["tables"])
         {
             YAML::Node tables = db_config_["tables"];
-            explore_tables(tables);
+            // Step 3 (optionnal): Reuse the schema snapshot of a previous run if the catalog did not change
+            if (connection_config_root["meta"] && connection_config_root["meta"]["schema_cache"])
+                explore_tables_cached(tables, connection_config_root["meta"]["schema_cache"].as<std::string>());
+            else
+                explore_tables(tables);
         }
     }
 
@@ -39,87 +93,294 @@ public:
         const std::string& order_by = "",
         const int& limit = 10000)
     {
+        StatementTimer timer(metrics_.get(), table_name, Operation::select);
         explore_if_unknown(table_name);
-        std::stringstream ss;
-        if (fields.size() == 0)
-            ss << "SELECT *";
+        utl::SqlBuffer::Lease buf;
+        select_statement(*buf, table_name, fields, condition, order_by);
+        buf->append(" LIMIT ").append_number(limit);
+        pqxx::result r;
+        bool cached = cache_ && cache_->ttl(table_name).count() > 0;
+        if (cached && cache_->get(buf->str(), r))
+            timer.cache_hit();
         else
         {
-            ss << "SELECT \"" << fields[0] << "\"";
-            for (size_t i = 1; i < fields.size(); i++)
-                ss << ", "
-                   << "\"" << fields[i] << "\"";
+            timer.built(buf->size());
+            std::uint64_t generation = cached ? cache_->generation(table_name) : 0;
+            r = execute(buf->str(), timer, true);
+            if (cached && timer.ok())
+                cache_->put(table_name, buf->str(), generation, r);
         }
 
-        ss << " FROM " << table_name;
-        if (!condition.empty())
-            ss << " WHERE " << condition;
-        if (!order_by.empty())
-            ss << " ORDER BY " << order_by;
-        ss << " LIMIT " << limit;
-        pqxx::result r = execute(ss.str());
-
         if (std::size(r) == limit)
             std::cout << "Warning : fetch reached maximum number (" << limit << ")" << std::endl;
 
         return r;
     }
 
+    /// Hands out every row of a select one at a time, streamed through COPY TO STDOUT without any LIMIT.
+    /// Values are given in text format; null values have a null data().
+    void select_stream(const std::string& table_name,
+        const std::function<void(const std::vector<pqxx::zview>&)>& on_row,
+        const std::vector<std::string> fields = std::vector<std::string>(),
+        const std::string& condition = "",
+        const std::string& order_by = "")
+    {
+        StatementTimer timer(metrics_.get(), table_name, Operation::select);
+        explore_if_unknown(table_name);
+        utl::SqlBuffer::Lease buf;
+        select_statement(*buf, table_name, fields, condition, order_by);
+        const std::string& statement = buf->str();
+        timer.built(statement.size());
+        try
+        {
+            run_read([&](ConnectionPool::Lease& c) {
+                timer.acquired();
+                pqxx::work w(*c);
+                pqxx::stream_from stream = pqxx::stream_from::query(w, statement);
+                std::size_t rows = 0;
+                while (const std::vector<pqxx::zview>* row = stream.read_row())
+                {
+                    on_row(*row);
+                    rows++;
+                }
+                stream.complete();
+                timer.executed(rows);
+                w.commit();
+                timer.committed();
+            }, false);
+        } catch (const std::exception& e)
+        {
+            timer.failed();
+            std::cerr << "\nError : " << e.what() << "was raised while streaming the following statement : \n"
+                      << statement << '\n';
+        }
+    }
+
+    /// Hands out every row of a select in batches of at most batch_size rows, fetched from a server-side cursor.
+    /// Only one batch is held in memory at a time. batch_size must not be 0. Each call declares its own cursor, so
+    /// on_batch may itself call select_batches.
+    void select_batches(const std::string& table_name,
+        const std::function<void(const pqxx::result&)>& on_batch,
+        size_t batch_size = 10000,
+        const std::vector<std::string> fields = std::vector<std::string>(),
+        const std::string& condition = "",
+        const std::string& order_by = "")
+    {
+        if (batch_size == 0)
+        {
+            std::cerr << "\nError : select_batches of " << table_name << " needs a batch size of at least 1\n";
+            return;
+        }
+        static std::atomic<unsigned long> cursors{0};
+        const std::string cursor = "pgi_batches_" + std::to_string(cursors++);
+        StatementTimer timer(metrics_.get(), table_name, Operation::select);
+        explore_if_unknown(table_name);
+        utl::SqlBuffer::Lease buf;
+        buf->append("DECLARE ").append(cursor).append(" NO SCROLL CURSOR FOR ");
+        select_statement(*buf, table_name, fields, condition, order_by);
+        const std::string& statement = buf->str();
+        timer.built(statement.size());
+        try
+        {
+            run_read([&](ConnectionPool::Lease& c) {
+                timer.acquired();
+                pqxx::work w(*c);
+                w.exec(statement);
+                const std::string fetch = "FETCH FORWARD " + std::to_string(batch_size) + " FROM " + cursor;
+                std::size_t rows = 0;
+                for (;;)
+                {
+                    pqxx::result r = w.exec(fetch);
+                    if (r.empty())
+                        break;
+                    on_batch(r);
+                    rows += std::size(r);
+                    if (size_t(std::size(r)) < batch_size)
+                        break;
+                }
+                w.exec("CLOSE " + cursor);
+                timer.executed(rows);
+                w.commit();
+                timer.committed();
+            }, false);
+        } catch (const std::exception& e)
+        {
+            timer.failed();
+            std::cerr << "\nError : " << e.what() << "was raised while fetching the following statement : \n"
+                      << statement << '\n';
+        }
+    }
+
+    /// Reads a whole table with one concurrent statement per partition, each streamed like select_stream.
+    /// The table is split in ranges of heap blocks (ctid), so that it needs no primary key or index. Partitions
+    /// run on up to open_connections - 1 pooled connections sharing the snapshot exported by a leading
+    /// transaction, so that together they see the table at a single point in time. With a single pooled
+    /// connection they run one after the other. on_row is called concurrently from several threads, with the
+    /// index of the partition of the row. partitions defaults to the number of pooled connections.
+    /// Block ranges are only read efficiently by the TID range scans of PostgreSQL 14, so with an older server the
+    /// table is read as a single partition. Returns false if a partition failed.
+    bool parallel_select(const std::string& table_name,
+        const std::function<void(std::size_t, const std::vector<pqxx::zview>&)>& on_row,
+        std::size_t partitions = 0,
+        const std::vector<std::string> fields = std::vector<std::string>(),
+        const std::string& condition = "")
+    {
+        return run_partitions(table_name, partitions, fields, condition,
+            [&](std::size_t partition, pqxx::transaction_base& w, const std::string& statement) {
+                pqxx::stream_from stream = pqxx::stream_from::query(w, statement);
+                while (const std::vector<pqxx::zview>* row = stream.read_row())
+                    on_row(partition, *row);
+                stream.complete();
+            });
+    }
+
+    /// Exports a table like parallel_select, writing each partition in COPY text format (tab separated, \N for
+    /// null) to its own file path_prefix + "_" + partition index + ".tsv", which COPY FROM reads back.
+    /// Returns false if a partition failed.
+    bool export_table(const std::string& table_name,
+        const std::string& path_prefix,
+        std::size_t partitions = 0,
+        const std::vector<std::string> fields = std::vector<std::string>(),
+        const std::string& condition = "")
+    {
+        return run_partitions(table_name, partitions, fields, condition,
+            [&](std::size_t partition, pqxx::transaction_base& w, const std::string& statement) {
+                const std::string path = path_prefix + "_" + std::to_string(partition) + ".tsv";
+                std::ofstream out(path, std::ios::binary | std::ios::trunc);
+                if (!out)
+                    throw std::runtime_error("cannot open " + path);
+                pqxx::stream_from stream = pqxx::stream_from::query(w, statement);
+                for (auto line = stream.get_raw_line(); line.first; line = stream.get_raw_line())
+                {
+                    out.write(line.first.get(), std::streamsize(line.second));
+                    out.put('\n');
+                }
+                stream.complete();
+                if (!out.flush())
+                    throw std::runtime_error("cannot write " + path);
+            });
+    }
+
+    /// Selects fields into one contiguous vector per field (struct of arrays), decoded directly from the
+    /// streamed text values. Ts gives the type of each field, in order.
+    /// Example : auto [t, x] = dbw.select_columns<time_point_t, double>("public.test_table", {"time", "test_double"});
+    template <typename... Ts>
+    std::tuple<std::vector<Ts>...> select_columns(const std::string& table_name,
+        const std::vector<std::string>& fields,
+        const std::string& condition = "",
+        const std::string& order_by = "")
+    {
+        std::tuple<std::vector<Ts>...> columns;
+        if (fields.size() != sizeof...(Ts))
+        {
+            std::cerr << "\nError : select_columns on " << table_name << " expects " << sizeof...(Ts)
+                      << " fields, got " << fields.size() << '\n';
+            return columns;
+        }
+        select_stream(
+            table_name,
+            [&columns](const std::vector<pqxx::zview>& row) {
+                utl::append_decoded_row(columns, row, std::index_sequence_for<Ts...>{});
+            },
+            fields, condition, order_by);
+        return columns;
+    }
+
     pqxx::result select_all_columns(const std::string& table_name, const std::string& condition = "")
     {
         return select(table_name, std::vector<std::string>(), condition);
     }
 
-    void print(pqxx::result r)
+    void print(pqxx::result r) { print(r, std::cout); }
+
+    /// Prints a result as a table. Column widths are resolved once, then every row is formatted into a single
+    /// buffer written at once, or each time it holds chunk_bytes bytes when chunk_bytes is not 0.
+    /// Nothing is printed for an empty result, not even the header.
+    void print(const pqxx::result& r, std::ostream& out, std::size_t chunk_bytes = 0)
     {
-        bool header_added = false;
-        std::stringstream ss;
-        int const num_rows = std::size(r);
-        for (int rownum = 0; rownum < num_rows; ++rownum)
+        if (r.empty())
+            return;
+        std::vector<std::size_t> widths = column_widths(r);
+        std::size_t line_size = 1;
+        for (std::size_t width : widths)
+            line_size += width + 2;
+        std::string text;
+        text.reserve(chunk_bytes ? chunk_bytes + line_size : line_size * (std::size(r) + 1));
+        int const num_cols = r.columns();
+        for (int colnum = 0; colnum < num_cols; ++colnum)
+            append_cell(text, r.column_name(colnum), widths[colnum]);
+        text += '\n';
+        for (auto const& row : r)
         {
-            pqxx::row const row = r[rownum];
-            ss << print_row(row, !header_added);
-            if (!header_added)
-                header_added = true;
-            ss << "\n";
+            append_row(text, row, widths);
+            if (chunk_bytes && text.size() >= chunk_bytes)
+            {
+                out.write(text.data(), std::streamsize(text.size()));
+                text.clear();
+            }
         }
-        std::cout << ss.str();
+        out.write(text.data(), std::streamsize(text.size()));
     }
 
     std::string print_row(const pqxx::row& row, bool header = false)
     {
-        const char fill = ' ';
-        const char separator[3] = " |";
-        std::stringstream ss;
-        std::stringstream headerss;
-        int const num_cols = std::size(row);
-        for (int colnum = 0; colnum < num_cols; ++colnum)
+        std::vector<std::string> names;
+        std::vector<std::string> typnames;
+        for (auto const& field : row)
         {
-            pqxx::field const field = row[colnum];
-            std::string column_name = field.name();
-            std::string column_type = get_typname_from_oid(field.type());
-            YAML::Node field_length_mapping = db_config_["field_length_mapping"];
-            int field_width;
-            if (field_length_mapping[column_type])
-                field_width = field_length_mapping[column_type].as<int>();
-            else
-                field_width = 10;
-            field_width = std::max<int>(column_name.length(), field_width);
-            ss << std::left << std::setw(field_width) << std::setfill(fill) << utl::truncate(field.c_str(), field_width)
-               << separator;
-            if (header)
-                headerss << std::left << std::setw(field_width) << std::setfill(fill)
-                         << utl::truncate(column_name, field_width) << separator;
+            names.push_back(field.name());
+            typnames.push_back(get_typname_from_oid(field.type()));
         }
+        std::vector<std::size_t> widths = column_widths(names, typnames);
+        std::string text;
         if (header)
         {
-            headerss << "\n" << ss.str();
-            return headerss.str();
+            for (size_t i = 0; i < names.size(); i++)
+                append_cell(text, names[i], widths[i]);
+            text += '\n';
         }
-        else
+        append_row(text, row, widths);
+        text.pop_back();
+        return text;
+    }
+
+    /// Prints a whole table, or the selected fields and rows of it, streaming the rows through COPY. Text is
+    /// written every chunk_bytes bytes, so that the table is never held in memory.
+    void print_stream(const std::string& table_name,
+        const std::vector<std::string> fields = std::vector<std::string>(),
+        const std::string& condition = "",
+        std::ostream& out = std::cout,
+        std::size_t chunk_bytes = 1 << 16)
+    {
+        const TableSchema& schema = table_schema(table_name);
+        std::vector<std::string> names = fields.empty() ? schema.column_names : fields;
+        std::vector<std::string> typnames;
+        for (auto const& name : names)
         {
-            return ss.str();
+            int index = schema.column_index(name);
+            typnames.push_back(index < 0 ? "" : schema.column_typnames[index]);
         }
+        std::vector<std::size_t> widths = column_widths(names, typnames);
+
+        std::string text;
+        text.reserve(chunk_bytes * 2);
+        for (size_t i = 0; i < names.size(); i++)
+            append_cell(text, names[i], widths[i]);
+        text += '\n';
+        select_stream(
+            table_name,
+            [&](const std::vector<pqxx::zview>& row) {
+                for (size_t i = 0; i < row.size() && i < widths.size(); i++)
+                    append_cell(text, row[i].data() ? std::string_view(row[i]) : std::string_view(), widths[i]);
+                text += '\n';
+                if (text.size() >= chunk_bytes)
+                {
+                    out.write(text.data(), std::streamsize(text.size()));
+                    text.clear();
+                }
+            },
+            fields, condition);
+        out.write(text.data(), std::streamsize(text.size()));
     }
 
     void print(const std::string& table_name) { return print(select_all_columns(table_name)); }
@@ -127,303 +388,1662 @@ public:
 
     /// Inserts a row in a defined table from a full set of values.
     /// The order of values must be the same as in the table definition.
+    /// Arithmetic values are bound to a prepared statement, other values are written as SQL literals
+    /// (e.g. "NOW()" or "'text'").
     template <typename... Args>
     void insert(const std::string& table_name, const Args&... values)
     {
+        StatementTimer timer(metrics_.get(), table_name, Operation::insert);
         explore_if_unknown(table_name);
-        std::stringstream ss;
-        ss << insert_statement_first_part(table_name);
-
-        ((ss << values << ", "), ...);
-        ss.seekp(-2, ss.cur);
-        ss << ')';
-        execute(ss.str());
+        if constexpr ((std::is_arithmetic<Args>::value && ...))
+        {
+            if (!known_table(table_name))
+            {
+                timer.failed();
+                return;
+            }
+            const PreparedStatement& statement = prepared_insert(table_name, sizeof...(values));
+            pqxx::params params(values...);
+            timer.built(0);
+            execute_prepared(statement, params, timer);
+        }
+        else
+        {
+            utl::SqlBuffer::Lease buf;
+            insert_statement(*buf, table_name, values...);
+            timer.built(buf->size());
+            execute(buf->str(), timer);
+        }
+        wrote(table_name);
     }
 
-    /// Inserts a row in a defined table from a multiple std::map<std::string, T>.
+    /// Inserts a row in a defined table from a multiple std::map<std::string, T>. A key in several maps takes the
+    /// value of the first map having it. In write-behind mode the row is only queued, see enable_write_behind().
+    /// The table and the columns are checked first, since a failure of the background write could not be reported
+    /// to the caller.
     template <typename... Args>
     void insert_from_maps(const std::string& table_name, Args... maps)
     {
-        std::map<std::string, std::string> merged_maps = utl::merge_maps(maps...);
-        std::stringstream columns, values, ss;
-        columns << "(";
-        values << "(";
-        for (auto const& [key, val] : merged_maps)
+        if (std::shared_ptr<WriteBehindQueue> queue = std::atomic_load(&write_behind_))
         {
-            columns << "\"" << key << "\", ";
-            values << val << ", ";
+            const TableSchema& schema = table_schema(table_name);
+            if (!(has_columns(schema, table_name, maps) && ...))
+                return;
+            utl::ShadowedKeys shadowed(maps...);
+            QueuedRow row;
+            row.table = table_name;
+            (utl::append_copy_columns(row.columns, maps, shadowed), ...);
+            (utl::append_copy_values(row.line, maps, shadowed), ...);
+            row.line.pop_back();
+            queue->push(std::move(row));
+            return;
         }
-        columns.seekp(-2, columns.cur);
-        columns << ")";
-        values.seekp(-2, values.cur);
-        values << ")";
-
-        ss << "INSERT INTO " << table_name << " " << columns.str() << "VALUES " << values.str();
+        StatementTimer timer(metrics_.get(), table_name, Operation::insert);
         explore_if_unknown(table_name);
-        execute(ss.str());
+        utl::SqlBuffer::Lease buf;
+        insert_from_maps_statement(*buf, table_name, maps...);
+        timer.built(buf->size());
+        execute(buf->str(), timer);
+        wrote(table_name);
     }
 
     /// Inserts a row in a defined table from a multiple std::map<std::string, std::vector<T>>.
     template <typename... Args>
     void bulk_insert_from_maps(const std::string& table_name, const Args&... maps)
     {
-        std::map<std::string, std::vector<std::string>> merged_maps = utl::merge_maps(maps...);
-        std::stringstream columns, ss;
-        std::vector<std::shared_ptr<std::stringstream>> values;
-        size_t bulk_len = merged_maps.begin()->second.size();
-        columns << "(";
-
-        for (size_t i = 0; i < bulk_len; i++)
-        {
-            std::shared_ptr<std::stringstream> valuesss(new std::stringstream());
-            *valuesss << "(";
-            values.push_back(valuesss);
-        }
+        StatementTimer timer(metrics_.get(), table_name, Operation::bulk);
+        explore_if_unknown(table_name);
+        utl::SqlBuffer::Lease buf;
+        bulk_insert_statement(*buf, table_name, maps...);
+        timer.built(buf->size());
+        execute(buf->str(), timer);
+        wrote(table_name);
+    }
 
-        for (auto const& [key, val_vec] : merged_maps)
+    /// Inserts rows in a defined table from a multiple std::map<std::string, std::vector<T>> through COPY FROM STDIN.
+    /// Values are encoded in COPY text format straight from the typed vectors, no INSERT statement is built.
+    template <typename... Args>
+    void bulk_copy_from_maps(const std::string& table_name, const Args&... maps)
+    {
+        StatementTimer timer(metrics_.get(), table_name, Operation::bulk);
+        explore_if_unknown(table_name);
+        size_t bulk_len = std::get<0>(std::forward_as_tuple(maps...)).begin()->second.size();
+        timer.built(0);
+        try
         {
-            columns << "\"" << key << "\", ";
-            size_t i = 0;
-            for (auto const& val : val_vec)
-            {
-                (*(values[i])) << val << ", ";
-                i++;
-            }
-        }
-        columns.seekp(-2, columns.cur);
-        columns << ")";
-        ss << "INSERT INTO " << table_name << " " << columns.str() << "VALUES ";
-        for (size_t i = 0; i < bulk_len; i++)
+            pool_->run([&](ConnectionPool::Lease& c) {
+                timer.acquired();
+                pqxx::work w(*c);
+                timer.sent(copy_statement(w, table_name, maps...));
+                timer.executed(bulk_len);
+                w.commit();
+                timer.committed();
+            });
+        } catch (const std::exception& e)
         {
-            (*(values[i])).seekp(-2, (*(values[i])).cur);
-            (*(values[i])) << ")";
-            ss << (*(values[i])).str() << ", ";
+            timer.failed();
+            std::cerr << "\nError : " << e.what() << "was raised while copying " << bulk_len << " rows into "
+                      << table_name << '\n';
         }
-        ss.seekp(-2, ss.cur);
-        ss << "  ";
-        explore_if_unknown(table_name);
-        execute(ss.str());
+        wrote(table_name);
     }
 
     /// Inserts a row in a defined table from a multiple std::map<std::string, T>.
     template <typename... Args>
     void update_from_maps(const std::string& table_name, const std::string& condition, const Args&... maps)
     {
-        std::map<std::string, std::string> merged_maps = utl::merge_maps(maps...);
-        std::stringstream ss;
-        ss << "UPDATE " << table_name << " SET ";
-        for (auto const& [key, val] : merged_maps)
-            ss << "\"" << key << "\""
-               << "=" << val << ", ";
-
-        ss.seekp(-2, ss.cur);
-        ss << " WHERE " << condition;
+        StatementTimer timer(metrics_.get(), table_name, Operation::update);
         explore_if_unknown(table_name);
-        execute(ss.str());
+        utl::SqlBuffer::Lease buf;
+        update_statement(*buf, table_name, condition, maps...);
+        timer.built(buf->size());
+        execute(buf->str(), timer);
+        wrote(table_name);
+    }
+
+    /// Updates many rows at once from multiple std::map<std::string, std::vector<T>>, like bulk_insert_from_maps.
+    /// Rows are matched on key_column (the primary key if empty), which must be one of the map columns; every other
+    /// column is assigned. Up to bulk_update_copy_rows rows a single UPDATE ... FROM (VALUES ...) is sent, larger
+    /// batches are first copied into a temporary table then applied by one UPDATE ... FROM that table.
+    template <typename... Args>
+    void bulk_update_from_maps(const std::string& table_name, const std::string& key_column, const Args&... maps)
+    {
+        StatementTimer timer(metrics_.get(), table_name, Operation::update);
+        const TableSchema& schema = table_schema(table_name);
+        const std::string& key = key_column.empty() ? schema.primary_key_name() : key_column;
+        if (!((maps.count(key) > 0) || ...))
+        {
+            std::cerr << "\nError : bulk update of " << table_name << " needs the key column " << key
+                      << " among its columns\n";
+            return;
+        }
+        size_t bulk_len = std::get<0>(std::forward_as_tuple(maps...)).begin()->second.size();
+        if (bulk_len <= bulk_update_copy_rows)
+        {
+            utl::SqlBuffer::Lease buf;
+            bulk_update_statement(*buf, table_name, key, maps...);
+            timer.built(buf->size());
+            execute(buf->str(), timer);
+            wrote(table_name);
+            return;
+        }
+
+        timer.built(0);
+        try
+        {
+            pool_->run([&](ConnectionPool::Lease& c) {
+                timer.acquired();
+                pqxx::work w(*c);
+                utl::ShadowedKeys shadowed(maps...);
+                utl::SqlBuffer::Lease buf;
+                buf->append("CREATE TEMP TABLE pgi_bulk_update ON COMMIT DROP AS SELECT ");
+                (utl::append_identifiers(*buf, maps, shadowed), ...);
+                buf->drop_last(2).append(" FROM ").append(table_name).append(" WITH NO DATA");
+                w.exec(buf->str());
+                timer.sent(buf->size() + copy_statement(w, "pgi_bulk_update", maps...));
+
+                buf->clear();
+                buf->append("UPDATE ").append(table_name).append(" AS t SET ");
+                (append_key_assignments(*buf, nullptr, key, maps, shadowed), ...);
+                buf->drop_last(2).append(" FROM pgi_bulk_update AS v WHERE t.").append_identifier(key);
+                buf->append(" = v.").append_identifier(key);
+                timer.sent(buf->size());
+                timer.executed(w.exec(buf->str()).affected_rows());
+                w.commit();
+                timer.committed();
+            });
+        } catch (const std::exception& e)
+        {
+            timer.failed();
+            std::cerr << "\nError : " << e.what() << "was raised while updating " << bulk_len << " rows of "
+                      << table_name << '\n';
+        }
+        wrote(table_name);
     }
 
+    /// Number of rows above which bulk_update_from_maps stages the rows through COPY.
+    static constexpr std::size_t bulk_update_copy_rows = 5000;
+
 
     // Specialization for vectors
+    /// A vector of row structs declared with PGI_ROW inserts one row per element, see insert_rows.
+    /// Like the variadic insert, arithmetic elements are bound to a prepared statement and other elements are
+    /// written as SQL literals.
     template <typename T>
     void insert(const std::string& table_name, const std::vector<T>& vector)
     {
-        explore_if_unknown(table_name);
-        std::stringstream ss;
-        ss << insert_statement_first_part(table_name);
-
-        for (T element : vector)
-            ss << element << ", ";
-        ss.seekp(-2, ss.cur);
-        ss << ')';
-        execute(ss.str());
+        if constexpr (utl::row_traits<T>::is_row)
+            insert_rows(table_name, vector);
+        else
+        {
+            StatementTimer timer(metrics_.get(), table_name, Operation::insert);
+            explore_if_unknown(table_name);
+            if constexpr (std::is_arithmetic<T>::value)
+            {
+                if (!known_table(table_name))
+                {
+                    timer.failed();
+                    return;
+                }
+                const PreparedStatement& statement = prepared_insert(table_name, vector.size());
+                pqxx::params params = vector_params(statement, vector);
+                timer.built(0);
+                execute_prepared(statement, params, timer);
+            }
+            else
+            {
+                utl::SqlBuffer::Lease buf;
+                vector_insert_statement(*buf, table_name, vector);
+                timer.built(buf->size());
+                execute(buf->str(), timer);
+            }
+            wrote(table_name);
+        }
     }
 
-    // Specialization for timed vectors
+    /// Inserts rows of a struct declared with PGI_ROW in a single transaction. Each member is bound to its
+    /// parameter of a statement prepared once per (table, row type), no map nor SQL text is built per row.
     template <typename T>
-    void insert(const std::string& table_name, time_point_t tp, const std::vector<T>& vector)
+    void insert_rows(const std::string& table_name, const std::vector<T>& rows)
     {
+        static_assert(utl::row_traits<T>::is_row, "Row type must be declared with PGI_ROW");
+        StatementTimer timer(metrics_.get(), table_name, Operation::insert);
         explore_if_unknown(table_name);
-        std::stringstream ss;
-        ss << insert_statement_first_part(table_name);
-        ss << "'" << utl::ISO_8601(tp) << "', ";
-        for (T element : vector)
-            ss << element << ", ";
-        ss.seekp(-2, ss.cur);
-        ss << ')';
-        execute(ss.str());
+        if (!known_table(table_name))
+        {
+            timer.failed();
+            return;
+        }
+        const PreparedStatement& statement = prepared_row_insert<T>(table_name);
+        timer.built(0);
+        try
+        {
+            pool_->run([&](ConnectionPool::Lease& c) {
+                timer.acquired();
+                c.prepare(statement);
+                pqxx::work w(*c);
+                exec_rows(w, statement, rows);
+                timer.executed(rows.size());
+                w.commit();
+                timer.committed();
+            });
+        } catch (const std::exception& e)
+        {
+            timer.failed();
+            std::cerr << "\nError : " << e.what() << "was raised while executing the following statement : \n"
+                      << statement.definition << '\n';
+        }
+        wrote(table_name);
     }
 
-    void clear(const std::string& table_name)
+    /// Inserts one row of a struct declared with PGI_ROW.
+    template <typename T>
+    void insert_row(const std::string& table_name, const T& row)
     {
-        std::stringstream ss;
-        ss << "TRUNCATE " << table_name << " CASCADE";
-        execute(ss.str());
+        insert_rows(table_name, std::vector<T>{row});
     }
 
-    pqxx::result execute(const std::string& statement)
+    // Specialization for timed vectors
+    template <typename T>
+    void insert(const std::string& table_name, time_point_t tp, const std::vector<T>& vector)
     {
-        pqxx::result r;
-        std::lock_guard<std::mutex> guard(mutex_);
-        try
+        StatementTimer timer(metrics_.get(), table_name, Operation::insert);
+        explore_if_unknown(table_name);
+        if constexpr (std::is_arithmetic<T>::value)
         {
-            pqxx::work w(*c_);
-            r = w.exec(statement);
-            w.commit();
-        } catch (const std::exception& e)
+            if (!known_table(table_name))
+            {
+                timer.failed();
+                return;
+            }
+            const PreparedStatement& statement = prepared_insert(table_name, vector.size() + 1);
+            pqxx::params params = vector_params(statement, vector, &tp);
+            timer.built(0);
+            execute_prepared(statement, params, timer);
+        }
+        else
         {
-            std::cerr << "\nError : " << e.what() << "was raised while executing the following statement : \n"
-                      << statement << '\n';
+            utl::SqlBuffer::Lease buf;
+            vector_insert_statement(*buf, table_name, vector, &tp);
+            timer.built(buf->size());
+            execute(buf->str(), timer);
         }
-        return r;
+        wrote(table_name);
     }
 
-    pqxx::row execute1(const std::string& statement)
+    /// Inserts a timed vector as a single value, into a table whose first two inserted columns are the time and
+    /// either an array (int2[], int4[], int8[], float4[] or float8[]) or a bytea. An array is sent in binary format,
+    /// a bytea holds the vector compressed by codec (see utl::pack). Both decode back with
+    /// select_columns<time_point_t, std::vector<T>>.
+    template <typename T>
+    void insert_packed(const std::string& table_name,
+        time_point_t tp,
+        const std::vector<T>& vector,
+        utl::PackedCodec codec = utl::default_codec<T>())
     {
-        pqxx::row r;
-        std::lock_guard<std::mutex> guard(mutex_);
-        try
+        StatementTimer timer(metrics_.get(), table_name, Operation::insert);
+        explore_if_unknown(table_name);
+        if (!known_table(table_name))
         {
-            pqxx::work w(*c_);
-            r = w.exec1(statement);
-            w.commit();
-        } catch (const std::exception& e)
+            timer.failed();
+            return;
+        }
+        const PreparedStatement& statement = prepared_insert(table_name, 2);
+        pqxx::oid type = statement.param_types.size() > 1 ? statement.param_types[1] : 0;
+        utl::byte_string packed = type == utl::bytea_oid ? utl::pack(vector, codec) : utl::array_binary(vector, type);
+        if (packed.empty())
         {
-            std::cerr << "\nError : " << e.what() << "was raised while executing the following statement : \n"
-                      << statement << '\n';
+            timer.failed();
+            std::cerr << "\nError : the second column of " << table_name
+                      << " is neither an array of numbers nor a bytea, cannot insert a packed vector\n";
+            return;
         }
-        return r;
+        pqxx::params params;
+        utl::append_param(params, tp, statement.param_types.empty() ? 0 : statement.param_types[0]);
+        timer.built(0);
+        timer.sent(packed.size());
+        params.append(std::move(packed));
+        execute_prepared(statement, params, timer);
+        wrote(table_name);
     }
 
-protected:
-    void connect(YAML::Node connection_config)
+    void clear(const std::string& table_name)
     {
-        try
-        {
-            std::stringstream ss;
-            for (YAML::const_iterator it = connection_config.begin(); it != connection_config.end(); ++it)
-                ss << it->first.as<std::string>() << "=" << it->second.as<std::string>() << " ";
+        StatementTimer timer(metrics_.get(), table_name, Operation::other);
+        utl::SqlBuffer::Lease buf;
+        buf->append("TRUNCATE ").append(table_name).append(" CASCADE");
+        timer.built(buf->size());
+        execute(buf->str(), timer);
+        wrote(table_name);
+    }
 
-            std::string connection_string = ss.str();
+    /// Opens a pipelined session on one of the pooled connections, see Pipeline.
+    Pipeline pipeline();
 
-            std::shared_ptr<pqxx::connection> buff(new pqxx::connection(connection_string));
-            c_ = buff;
+    /// Opens a transaction on one of the pooled connections, see Transaction.
+    Transaction begin();
 
-        } catch (const std::exception& e)
-        {
-            std::cerr << e.what() << '\n';
-        }
-    };
+    /// Switches to write-behind mode: insert_from_maps queues its row and returns immediately, and a background
+    /// thread writes the queued rows in COPY batches. Rows queued before are written first. With adaptive batching,
+    /// the decisions are published to metrics() if it was enabled before.
+    void enable_write_behind(WriteBehindOptions options)
+    {
+        // Cached results of a table are dropped once its queued rows are committed
+        options.written = [this, written = std::move(options.written)](const std::string& table_name) {
+            wrote(table_name);
+            if (written)
+                written(table_name);
+        };
+        // The previous queue is drained before the new one starts writing
+        std::atomic_store(&write_behind_, std::shared_ptr<WriteBehindQueue>());
+        std::atomic_store(&write_behind_, std::make_shared<WriteBehindQueue>(pool_, options, metrics_));
+    }
+
+    /// Leaves write-behind mode once every queued row has been written.
+    void disable_write_behind() { std::atomic_store(&write_behind_, std::shared_ptr<WriteBehindQueue>()); }
 
-    void explore_tables(YAML::Node tables)
+    /// In write-behind mode, returns once every row queued before the call has been written.
+    void flush()
     {
+        if (std::shared_ptr<WriteBehindQueue> queue = std::atomic_load(&write_behind_))
+            queue->flush();
+    }
+
+    /// Write-behind queue, null unless write-behind mode is enabled.
+    std::shared_ptr<WriteBehindQueue> write_behind() const { return std::atomic_load(&write_behind_); }
+
+    /// Opens the connections used by the *_async methods, all driven by one background thread (see AsyncExecutor).
+    /// Without it, the first *_async call opens as many connections as the pool has.
+    void enable_async(std::size_t connections)
+    {
+        std::lock_guard<std::mutex> guard(async_mutex_);
         try
         {
-            for (std::size_t i = 0; i < tables.size(); i++)
-                get_column_details(tables[i].as<std::string>());
+            async_.reset();
+            async_.reset(new AsyncExecutor(connection_string_, connections));
         } catch (const std::exception& e)
         {
             std::cerr << e.what() << '\n';
         }
     }
 
-    void get_column_details(const std::string& table_name)
-    {
-        try
-        {
-            std::stringstream ss(table_name);
-            std::string segment;
-            std::vector<std::string> seglist;
+    // Non-blocking variants of execute, select and the insert methods. The statement is built on the calling
+    // thread (exploring an unknown table first) then sent by the async executor; the calling thread never waits
+    // for the server. The returned future throws std::runtime_error if the statement failed.
 
-            std::getline(ss, segment, '.');
-            db_config_["tables_details"][table_name]["schema"] = segment;
-            std::getline(ss, segment, '.');
-            db_config_["tables_details"][table_name]["table"] = segment;
+    std::future<AsyncResult> execute_async(const std::string& statement)
+    {
+        return async_executor()->execute(statement);
+    }
 
+    /// Calls done on the async executor thread once the statement completed, see AsyncExecutor::callback_t.
+    void execute_async(const std::string& statement, AsyncExecutor::callback_t done)
+    {
+        async_executor()->execute(statement, std::move(done));
+    }
 
-            pqxx::result r = execute(utl::string_format("SELECT * FROM %s LIMIT 0", table_name));
+    std::future<AsyncResult> select_async(const std::string& table_name,
+        const std::vector<std::string> fields = std::vector<std::string>(),
+        const std::string& condition = "",
+        const std::string& order_by = "",
+        const int& limit = 10000)
+    {
+        explore_if_unknown(table_name);
+        utl::SqlBuffer::Lease buf;
+        select_statement(*buf, table_name, fields, condition, order_by);
+        buf->append(" LIMIT ").append_number(limit);
+        return execute_async(buf->str());
+    }
 
-            for (size_t i = 0; i < size_t(r.columns()); i++)
-            {
-                db_config_["tables_details"][table_name]["columns"][std::string(r.column_name(i))] =
-                    get_typname_from_oid(r.column_type(i));
-            }
+    template <typename... Args>
+    std::future<AsyncResult> insert_async(const std::string& table_name, const Args&... values)
+    {
+        explore_if_unknown(table_name);
+        utl::SqlBuffer::Lease buf;
+        insert_statement(*buf, table_name, values...);
+        return write_async(table_name, buf->str());
+    }
 
-            r = execute(utl::string_format(
-                "SELECT c.column_name, c.data_type "
-                "FROM information_schema.table_constraints tc "
-                "JOIN information_schema.constraint_column_usage AS ccu USING (constraint_schema, constraint_name) "
-                "JOIN information_schema.columns AS c ON c.table_schema = '%s' "
-                "  AND tc.table_name = '%s' AND ccu.column_name = c.column_name "
-                "WHERE constraint_type = 'PRIMARY KEY';",
-                db_config_["tables_details"][table_name]["schema"].as<std::string>(),
-                db_config_["tables_details"][table_name]["table"].as<std::string>()));
-            if (!r.empty())
-                db_config_["tables_details"][table_name]["primary_key"] = r[0][0].as<std::string>();
-            else
-                db_config_["tables_details"][table_name]["primary_key"] = "_none_";
+    template <typename... Args>
+    std::future<AsyncResult> insert_from_maps_async(const std::string& table_name, const Args&... maps)
+    {
+        explore_if_unknown(table_name);
+        utl::SqlBuffer::Lease buf;
+        insert_from_maps_statement(*buf, table_name, maps...);
+        return write_async(table_name, buf->str());
+    }
 
-        } catch (const std::exception& e)
-        {
-            std::cerr << e.what() << '\n';
-        }
+    template <typename... Args>
+    std::future<AsyncResult> bulk_insert_from_maps_async(const std::string& table_name, const Args&... maps)
+    {
+        explore_if_unknown(table_name);
+        utl::SqlBuffer::Lease buf;
+        bulk_insert_statement(*buf, table_name, maps...);
+        return write_async(table_name, buf->str());
     }
 
-    std::string get_typname_from_oid(int oid)
+    template <typename... Args>
+    std::future<AsyncResult> update_from_maps_async(
+        const std::string& table_name, const std::string& condition, const Args&... maps)
     {
-        pqxx::row row;
-        row = execute1(utl::string_format("SELECT t.typname FROM pg_type t WHERE t.oid = %d", oid));
-        return row[0].as<std::string>();
+        explore_if_unknown(table_name);
+        utl::SqlBuffer::Lease buf;
+        update_statement(*buf, table_name, condition, maps...);
+        return write_async(table_name, buf->str());
     }
 
-    void drop_config_yaml(const std::string& output_file)
+    /// Calls handler on a background thread with every notification sent on channel (NOTIFY or pg_notify()), see
+    /// NotificationListener. The first subscription opens a dedicated connection waiting on its socket, so no pooled
+    /// connection is held. Returns the id to unsubscribe with, 0 if the listener connection failed.
+    std::size_t subscribe(const std::string& channel, NotificationListener::handler_t handler)
     {
+        std::lock_guard<std::mutex> guard(listener_mutex_);
         try
         {
-            std::ofstream fout;
-            fout.open(output_file);
-            fout << db_config_ << "\n";
-            fout.close();
+            if (!listener_)
+                listener_.reset(new NotificationListener(connection_string_));
+            return listener_->subscribe(channel, std::move(handler));
         } catch (const std::exception& e)
         {
-            std::cerr << e.what() << '\n';
+            std::cerr << "\nError : " << e.what() << "was raised while subscribing to channel " << channel << '\n';
+            return 0;
         }
     }
 
-    std::string insert_statement_first_part(const std::string& table_name)
+    void unsubscribe(std::size_t id)
+    {
+        std::lock_guard<std::mutex> guard(listener_mutex_);
+        if (listener_)
+            listener_->unsubscribe(id);
+    }
+
+    /// Sends a notification to the subscribers of channel, delivered once the statement committed.
+    void notify(const std::string& channel, const std::string& payload = "")
+    {
+        utl::SqlBuffer::Lease buf;
+        buf->append("SELECT pg_notify(").append_literal(channel).append(", ").append_literal(payload).append(")");
+        execute(buf->str());
+    }
+
+    /// Installs a trigger notifying channel (the table name if empty) after every inserted, updated or deleted row
+    /// of a table. The payload is a JSON object with the table, the operation (op) and the row, which is left out
+    /// when the payload would exceed the 8000 bytes limit of NOTIFY. Subscribe to the same channel to receive it.
+    void install_notify_trigger(const std::string& table_name, const std::string& channel = "")
     {
         explore_if_unknown(table_name);
-        std::stringstream ss;
-        ss << "INSERT INTO " << table_name << "(";
-        for (YAML::const_iterator it = db_config_["tables_details"][table_name]["columns"].begin();
-             it != db_config_["tables_details"][table_name]["columns"].end(); ++it)
-        {
-            // Include column only if it is not a primary key ewcept if it is of type timezone
-            if ((it->first.as<std::string>() !=
-                    db_config_["tables_details"][table_name]["primary_key"].as<std::string>()) ||
-                (it->second.as<std::string>().find("timestamp") != std::string::npos))
-            {
-                ss << "\"" << it->first.as<std::string>() << "\", ";
-            }
+        execute(R"(CREATE OR REPLACE FUNCTION pgi_notify_row() RETURNS trigger LANGUAGE plpgsql AS $$
+DECLARE
+    changed json;
+    payload text;
+BEGIN
+    IF TG_OP = 'DELETE' THEN
+        changed := row_to_json(OLD);
+    ELSE
+        changed := row_to_json(NEW);
+    END IF;
+    payload := json_build_object('table', TG_TABLE_SCHEMA || '.' || TG_TABLE_NAME, 'op', TG_OP, 'row', changed)::text;
+    IF octet_length(payload) >= 8000 THEN
+        payload := json_build_object('table', TG_TABLE_SCHEMA || '.' || TG_TABLE_NAME, 'op', TG_OP)::text;
+    END IF;
+    PERFORM pg_notify(TG_ARGV[0], payload);
+    RETURN NULL;
+END $$)");
+        utl::SqlBuffer::Lease buf;
+        buf->append("DROP TRIGGER IF EXISTS pgi_notify ON ").append(table_name);
+        execute(buf->str());
+        buf->clear();
+        buf->append("CREATE TRIGGER pgi_notify AFTER INSERT OR UPDATE OR DELETE ON ").append(table_name);
+        buf->append(" FOR EACH ROW EXECUTE PROCEDURE pgi_notify_row(");
+        buf->append_literal(channel.empty() ? table_name : channel).append(")");
+        execute(buf->str());
+    }
+
+    /// Opens a consumer of a logical replication slot, see ReplicationStream. Its changes refer to the schemas of
+    /// this worker, tables being explored on their first change if they are not listed under tables:. The
+    /// publication must exist (CREATE PUBLICATION ... FOR TABLE ...) and the server run with wal_level = logical.
+    std::unique_ptr<ReplicationStream> replication_stream(const ReplicationOptions& options = ReplicationOptions())
+    {
+        return std::unique_ptr<ReplicationStream>(
+            new ReplicationStream(connection_string_, options, [this](const std::string& table_name) {
+                const TableSchema& schema = table_schema(table_name);
+                return schema.column_names.empty() ? nullptr : &schema;
+            }));
+    }
+
+    // Statement builders, shared by the methods above, Pipeline and Transaction.
+    // Each appends a complete statement to buf. They never explore the table, their callers do it first on the
+    // connection they use: an unknown table is written without its schema, and the server reports the error.
+
+    /// SELECT fields FROM table_name [WHERE condition] [ORDER BY order_by]
+    void select_statement(utl::SqlBuffer& buf,
+        const std::string& table_name,
+        const std::vector<std::string>& fields,
+        const std::string& condition,
+        const std::string& order_by)
+    {
+        if (fields.size() == 0)
+            buf.append("SELECT *");
+        else
+        {
+            buf.append("SELECT ");
+            for (auto const& field : fields)
+                buf.append_identifier(field).append(", ");
+            buf.drop_last(2);
         }
 
-        ss.seekp(-2, ss.cur);
-        ss << ") VALUES(";
-        return ss.str();
+        buf.append(" FROM ").append(table_name);
+        if (!condition.empty())
+            buf.append(" WHERE ").append(condition);
+        if (!order_by.empty())
+            buf.append(" ORDER BY ").append(order_by);
     }
 
-    void explore_if_unknown(const std::string table_name)
+    /// INSERT of a full set of values written as SQL expressions, see insert.
+    template <typename... Args>
+    void insert_statement(utl::SqlBuffer& buf, const std::string& table_name, const Args&... values)
     {
-        if (db_config_["tables_details"][table_name])
-            return;
-        db_config_["tables"].push_back(table_name);
-        explore_tables(db_config_["tables"]);
+        append_insert_prefix(buf, table_name);
+        ((buf.append_sql(values).append(", ")), ...);
+        buf.drop_last(2).append(')');
     }
 
-    std::shared_ptr<pqxx::connection> c_;
+    /// INSERT of one row from multiple std::map<std::string, T>.
+    template <typename... Args>
+    void insert_from_maps_statement(utl::SqlBuffer& buf, const std::string& table_name, const Args&... maps)
+    {
+        utl::ShadowedKeys shadowed(maps...);
+        buf.append("INSERT INTO ").append(table_name).append(" (");
+        (utl::append_identifiers(buf, maps, shadowed), ...);
+        buf.drop_last(2).append(") VALUES (");
+        (utl::append_values(buf, maps, shadowed), ...);
+        buf.drop_last(2).append(')');
+    }
+
+    /// Multi-row INSERT from multiple std::map<std::string, std::vector<T>>.
+    template <typename... Args>
+    void bulk_insert_statement(utl::SqlBuffer& buf, const std::string& table_name, const Args&... maps)
+    {
+        size_t bulk_len = std::get<0>(std::forward_as_tuple(maps...)).begin()->second.size();
+        utl::ShadowedKeys shadowed(maps...);
+        buf.append("INSERT INTO ").append(table_name).append(" (");
+        (utl::append_identifiers(buf, maps, shadowed), ...);
+        buf.drop_last(2).append(") VALUES ");
+        for (size_t i = 0; i < bulk_len; i++)
+        {
+            size_t row_start = buf.size();
+            buf.append('(');
+            (utl::append_values_row(buf, maps, i, shadowed), ...);
+            buf.drop_last(2).append("), ");
+            // Size the buffer for the whole statement from the length of the first row
+            if (i == 0)
+                buf.reserve(buf.size() + (buf.size() - row_start) * (bulk_len - 1) * 5 / 4);
+        }
+        buf.drop_last(2);
+    }
+
+    /// UPDATE table_name SET ... WHERE condition, from multiple std::map<std::string, T>.
+    template <typename... Args>
+    void update_statement(utl::SqlBuffer& buf,
+        const std::string& table_name,
+        const std::string& condition,
+        const Args&... maps)
+    {
+        utl::ShadowedKeys shadowed(maps...);
+        buf.append("UPDATE ").append(table_name).append(" SET ");
+        (utl::append_assignments(buf, maps, shadowed), ...);
+        buf.drop_last(2).append(" WHERE ").append(condition);
+    }
+
+    /// UPDATE table_name AS t SET ... FROM (VALUES ...) AS v WHERE t.key_column = v.key_column, from multiple
+    /// std::map<std::string, std::vector<T>>. Values are cast to the column types, otherwise VALUES would give
+    /// text to the time and string columns.
+    template <typename... Args>
+    void bulk_update_statement(utl::SqlBuffer& buf,
+        const std::string& table_name,
+        const std::string& key_column,
+        const Args&... maps)
+    {
+        const TableSchema& schema = known_schema(table_name);
+        size_t bulk_len = std::get<0>(std::forward_as_tuple(maps...)).begin()->second.size();
+        utl::ShadowedKeys shadowed(maps...);
+        buf.append("UPDATE ").append(table_name).append(" AS t SET ");
+        (append_key_assignments(buf, &schema, key_column, maps, shadowed), ...);
+        buf.drop_last(2).append(" FROM (VALUES ");
+        for (size_t i = 0; i < bulk_len; i++)
+        {
+            buf.append('(');
+            (utl::append_values_row(buf, maps, i, shadowed), ...);
+            buf.drop_last(2).append("), ");
+        }
+        buf.drop_last(2).append(") AS v (");
+        (utl::append_identifiers(buf, maps, shadowed), ...);
+        buf.drop_last(2).append(") WHERE t.").append_identifier(key_column);
+        buf.append(" = v.").append_identifier(key_column);
+        append_cast(buf, schema, key_column);
+    }
+
+    // Statement runners, shared by the methods above and Transaction.
+
+    /// COPY of rows from multiple std::map<std::string, std::vector<T>> within a transaction. Each row is encoded
+    /// in COPY text format into a reused line buffer straight from the typed vectors.
+    template <typename... Args>
+    std::size_t copy_statement(pqxx::transaction_base& w, const std::string& table_name, const Args&... maps)
+    {
+        std::size_t bytes = 0;
+        utl::ShadowedKeys shadowed(maps...);
+        std::string columns;
+        (utl::append_copy_columns(columns, maps, shadowed), ...);
+        size_t bulk_len = std::get<0>(std::forward_as_tuple(maps...)).begin()->second.size();
+        pqxx::stream_to stream = pqxx::stream_to::raw_table(w, table_name, columns);
+        std::string line;
+        for (size_t i = 0; i < bulk_len; i++)
+        {
+            line.clear();
+            (utl::append_copy_row(line, maps, i, shadowed), ...);
+            line.pop_back();
+            stream.write_raw_line(line);
+            bytes += line.size() + 1;
+        }
+        stream.complete();
+        return bytes;
+    }
+
+    /// Executes a prepared PGI_ROW insert once per row within a transaction.
+    template <typename T>
+    static void exec_rows(pqxx::transaction_base& w, const PreparedStatement& statement, const std::vector<T>& rows)
+    {
+        for (auto const& row : rows)
+        {
+            pqxx::params params;
+            params.reserve(utl::row_traits<T>::size);
+            std::size_t i = 0;
+            utl::row_traits<T>::for_each(row, [&](auto const& field) {
+                utl::append_param(params, field, i < statement.param_types.size() ? statement.param_types[i] : 0);
+                i++;
+            });
+            w.exec_prepared(statement.name, params);
+        }
+    }
+
+    /// Parameters of a prepared vector insert, optionally preceded by a time point.
+    template <typename T>
+    static pqxx::params vector_params(
+        const PreparedStatement& statement, const std::vector<T>& vector, const time_point_t* tp = nullptr)
+    {
+        pqxx::params params;
+        params.reserve(vector.size() + 1);
+        if (tp)
+            utl::append_param(params, *tp, statement.param_types.empty() ? 0 : statement.param_types[0]);
+        for (const T& element : vector)
+            params.append(element);
+        return params;
+    }
+
+    /// Checks that every column of a map exists in an explored table, printing an error otherwise.
+    template <typename T>
+    static bool has_columns(
+        const TableSchema& schema, const std::string& table_name, const std::map<std::string, T>& map)
+    {
+        if (schema.column_names.empty())
+        {
+            std::cerr << "\nError : table " << table_name << " is unknown, its row is not queued\n";
+            return false;
+        }
+        for (auto const& [column, value] : map)
+        {
+            if (schema.column_index(column) >= 0)
+                continue;
+            std::cerr << "\nError : table " << table_name << " has no column " << column << ", its row is not queued\n";
+            return false;
+        }
+        return true;
+    }
+
+    /// INSERT of a vector of non arithmetic elements written as SQL literals, optionally preceded by a time point.
+    template <typename T>
+    void vector_insert_statement(utl::SqlBuffer& buf,
+        const std::string& table_name,
+        const std::vector<T>& vector,
+        const time_point_t* tp = nullptr)
+    {
+        append_insert_prefix(buf, table_name);
+        if (tp)
+            buf.append_value(*tp).append(", ");
+        for (const T& element : vector)
+            buf.append_sql(element).append(", ");
+        buf.drop_last(2).append(')');
+    }
+
+    pqxx::result execute(const std::string& statement)
+    {
+        StatementTimer timer(metrics_.get(), "", Operation::other);
+        timer.built(statement.size());
+        return execute(statement, timer);
+    }
+
+    /// Executes a prepared statement, preparing it first on the borrowed connection if needed.
+    pqxx::result execute_prepared(const PreparedStatement& statement, const pqxx::params& params)
+    {
+        StatementTimer timer(metrics_.get(), "", Operation::other);
+        timer.built(0);
+        return execute_prepared(statement, params, timer);
+    }
+
+    pqxx::row execute1(const std::string& statement)
+    {
+        StatementTimer timer(metrics_.get(), "", Operation::other);
+        timer.built(statement.size());
+        pqxx::row r;
+        try
+        {
+            pool_->run([&](ConnectionPool::Lease& c) {
+                timer.acquired();
+                pqxx::work w(*c);
+                r = w.exec1(statement);
+                timer.executed(1);
+                w.commit();
+                timer.committed();
+            });
+        } catch (const std::exception& e)
+        {
+            timer.failed();
+            std::cerr << "\nError : " << e.what() << "was raised while executing the following statement : \n"
+                      << statement << '\n';
+        }
+        return r;
+    }
+
+    /// Enables the metrics kept per table and operation, see Metrics. Calling it again keeps the current ones.
+    void enable_metrics()
+    {
+        if (!metrics_)
+            metrics_.reset(new Metrics());
+    }
+
+    /// Metrics of the statements run since enable_metrics(), null if metrics are disabled.
+    std::shared_ptr<Metrics> metrics() const { return metrics_; }
+
+    /// Enables the cache of select results, see ResultCache. Results of the tables given a time to live are served
+    /// from memory until it elapses or until this worker writes to the table through its insert, update, bulk,
+    /// write-behind, async, Pipeline or Transaction methods or clear. Writes through execute() or from other
+    /// processes are not seen: call invalidate_cache() after them.
+    void enable_result_cache(const ResultCacheOptions& options) { cache_.reset(new ResultCache(options)); }
+
+    /// Result cache, null unless enable_result_cache() was called.
+    std::shared_ptr<ResultCache> result_cache() const { return cache_; }
+
+    /// Drops the cached results of a table.
+    void invalidate_cache(const std::string& table_name) { wrote(table_name); }
+
+protected:
+    friend class Pipeline;
+    friend class Transaction;
+
+    /// Runs a statement on the primary, or on a replica when read is true.
+    pqxx::result execute(const std::string& statement, StatementTimer& timer, bool read = false)
+    {
+        pqxx::result r;
+        try
+        {
+            auto work = [&](ConnectionPool::Lease& c) {
+                timer.acquired();
+                pqxx::work w(*c);
+                r = w.exec(statement);
+                timer.executed(r.affected_rows());
+                w.commit();
+                timer.committed();
+            };
+            read ? run_read(work) : pool_->run(work);
+        } catch (const std::exception& e)
+        {
+            timer.failed();
+            std::cerr << "\nError : " << e.what() << "was raised while executing the following statement : \n"
+                      << statement << '\n';
+        }
+        return r;
+    }
+
+    pqxx::result execute_prepared(const PreparedStatement& statement, const pqxx::params& params, StatementTimer& timer)
+    {
+        pqxx::result r;
+        try
+        {
+            pool_->run([&](ConnectionPool::Lease& c) {
+                timer.acquired();
+                c.prepare(statement);
+                pqxx::work w(*c);
+                r = w.exec_prepared(statement.name, params);
+                timer.executed(r.affected_rows());
+                w.commit();
+                timer.committed();
+            });
+        } catch (const std::exception& e)
+        {
+            timer.failed();
+            std::cerr << "\nError : " << e.what() << "was raised while executing the following statement : \n"
+                      << statement.definition << '\n';
+        }
+        return r;
+    }
+
+    /// Appends "::type" of a column of the table, nothing if the column is unknown.
+    static void append_cast(utl::SqlBuffer& buf, const TableSchema& schema, const std::string& column_name)
+    {
+        int index = schema.column_index(column_name);
+        if (index >= 0)
+            buf.append("::").append(schema.column_typnames[index]);
+    }
+
+    /// Appends "column" = v."column" for every column of a map but the key and the shadowed ones, each followed
+    /// by ", ". Values are cast to the column types of schema unless it is null.
+    template <typename T>
+    static void append_key_assignments(utl::SqlBuffer& buf,
+        const TableSchema* schema,
+        const std::string& key_column,
+        const T& map,
+        const utl::ShadowedKeys& shadowed)
+    {
+        for (auto const& [key, val] : map)
+        {
+            if (key == key_column || shadowed.contains(key))
+                continue;
+            buf.append_identifier(key).append(" = v.").append_identifier(key);
+            if (schema)
+                append_cast(buf, *schema, key);
+            buf.append(", ");
+        }
+    }
+
+    /// Printed width of each column of a result, see column_widths(names, typnames).
+    std::vector<std::size_t> column_widths(const pqxx::result& r)
+    {
+        std::vector<std::string> names;
+        std::vector<std::string> typnames;
+        for (int colnum = 0; colnum < r.columns(); ++colnum)
+        {
+            names.push_back(r.column_name(colnum));
+            typnames.push_back(get_typname_from_oid(r.column_type(colnum)));
+        }
+        return column_widths(names, typnames);
+    }
+
+    /// Printed width of columns: the field_length_mapping entry of their type (10 if none), at least their name.
+    std::vector<std::size_t> column_widths(
+        const std::vector<std::string>& names, const std::vector<std::string>& typnames)
+    {
+        std::vector<std::size_t> widths;
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            auto it = field_widths_.find(typnames[i]);
+            std::size_t width = it == field_widths_.end() ? 10 : it->second;
+            widths.push_back(std::max(names[i].size(), width));
+        }
+        return widths;
+    }
+
+    /// Reads field_length_mapping once, so that printing does not look up the YAML tree.
+    void load_field_widths()
+    {
+        try
+        {
+            YAML::Node field_length_mapping = db_config_["field_length_mapping"];
+            if (field_length_mapping)
+                for (YAML::const_iterator it = field_length_mapping.begin(); it != field_length_mapping.end(); ++it)
+                    field_widths_[it->first.as<std::string>()] = it->second.as<std::size_t>();
+        } catch (const std::exception& e)
+        {
+            std::cerr << e.what() << '\n';
+        }
+    }
+
+    /// Appends a value truncated or padded to width, followed by the " |" separator.
+    static void append_cell(std::string& text, std::string_view value, std::size_t width)
+    {
+        std::size_t size = std::min(value.size(), width);
+        text.append(value.data(), size);
+        text.append(width - size, ' ');
+        text.append(" |");
+    }
+
+    static void append_row(std::string& text, const pqxx::row& row, const std::vector<std::size_t>& widths)
+    {
+        std::size_t colnum = 0;
+        for (auto const& field : row)
+            append_cell(text, std::string_view(field.c_str(), field.size()), widths[colnum++]);
+        text += '\n';
+    }
+
+    using snapshot_transaction =
+        pqxx::transaction<pqxx::isolation_level::repeatable_read, pqxx::write_policy::read_only>;
+
+    /// Splits a table in block ranges and calls scan(partition, transaction, statement) for each of them, see
+    /// parallel_select. Workers import the snapshot of the leading transaction, kept open until they are done.
+    template <typename F>
+    bool run_partitions(const std::string& table_name,
+        std::size_t partitions,
+        const std::vector<std::string>& fields,
+        const std::string& condition,
+        F&& scan)
+    {
+        if (partitions == 0)
+            partitions = pool_->size();
+        // Explored before the leading connection is borrowed, since exploring borrows one too
+        explore_if_unknown(table_name);
+        try
+        {
+            ConnectionPool::Lease leader = pool_->acquire();
+            snapshot_transaction lw(*leader);
+            long long blocks = lw.query_value<long long>("SELECT pg_relation_size(" + utl::quote_literal(table_name) +
+                                                         "::regclass) / current_setting('block_size')::bigint");
+            partitions = std::max<std::size_t>(1, std::min<std::size_t>(partitions, std::max(blocks, 1LL)));
+            // Without TID range scans (PostgreSQL < 14) every partition would scan the whole table
+            if (leader->server_version() < 140000)
+                partitions = 1;
+
+            std::vector<std::string> statements;
+            for (std::size_t i = 0; i < partitions; i++)
+            {
+                std::string range = condition;
+                if (partitions > 1)
+                {
+                    range = condition.empty() ? "" : "(" + condition + ") AND ";
+                    range += "ctid >= '(" + std::to_string(blocks * i / partitions) + ",0)'::tid";
+                    if (i + 1 < partitions)
+                        range += " AND ctid < '(" + std::to_string(blocks * (i + 1) / partitions) + ",0)'::tid";
+                }
+                utl::SqlBuffer::Lease buf;
+                select_statement(*buf, table_name, fields, range, "");
+                statements.push_back(buf->str());
+            }
+
+            if (pool_->size() < 2)
+            {
+                for (std::size_t i = 0; i < partitions; i++)
+                    scan(i, lw, statements[i]);
+                lw.commit();
+                return true;
+            }
+
+            const std::string snapshot = lw.query_value<std::string>("SELECT pg_export_snapshot()");
+            std::atomic<std::size_t> next{0};
+            std::atomic<bool> ok{true};
+            std::vector<std::thread> workers;
+            for (std::size_t t = 0; t < std::min(partitions, pool_->size() - 1); t++)
+            {
+                workers.emplace_back([&] {
+                    std::size_t i = partitions;
+                    try
+                    {
+                        ConnectionPool::Lease c = pool_->acquire();
+                        snapshot_transaction w(*c);
+                        w.exec("SET TRANSACTION SNAPSHOT " + utl::quote_literal(snapshot));
+                        while (ok && (i = next++) < partitions)
+                            scan(i, w, statements[i]);
+                        w.commit();
+                    } catch (const std::exception& e)
+                    {
+                        ok = false;
+                        std::cerr << "\nError : " << e.what() << "was raised while reading a partition of "
+                                  << table_name << (i < partitions ? " : \n" + statements[i] : "") << '\n';
+                    }
+                });
+            }
+            for (std::thread& worker : workers)
+                worker.join();
+            lw.commit();
+            return ok;
+        } catch (const std::exception& e)
+        {
+            std::cerr << "\nError : " << e.what() << "was raised while partitioning " << table_name << '\n';
+            return false;
+        }
+    }
+
+    /// Reads the meta/result_cache configuration node.
+    static ResultCacheOptions result_cache_options(YAML::Node config)
+    {
+        ResultCacheOptions options;
+        if (config["ttl_ms"])
+            options.default_ttl = std::chrono::milliseconds(config["ttl_ms"].as<long>());
+        if (config["max_entries"])
+            options.max_entries = config["max_entries"].as<std::size_t>();
+        if (config["tables"])
+            for (YAML::const_iterator it = config["tables"].begin(); it != config["tables"].end(); ++it)
+                options.table_ttl[it->first.as<std::string>()] = std::chrono::milliseconds(it->second.as<long>());
+        return options;
+    }
+
+    /// Drops the cached results of a table after a write to it.
+    void wrote(const std::string& table_name)
+    {
+        if (cache_)
+            cache_->invalidate(table_name);
+    }
+
+    /// Sends a write statement through the async executor, dropping the cached results of its table once it
+    /// completed.
+    std::future<AsyncResult> write_async(const std::string& table_name, const std::string& statement)
+    {
+        if (!cache_)
+            return execute_async(statement);
+        auto promise = std::make_shared<std::promise<AsyncResult>>();
+        std::future<AsyncResult> future = promise->get_future();
+        execute_async(statement, [this, promise, table_name](AsyncResult&& r, const std::string& error) {
+            wrote(table_name);
+            if (error.empty())
+                promise->set_value(std::move(r));
+            else
+                promise->set_exception(std::make_exception_ptr(std::runtime_error(error)));
+        });
+        return future;
+    }
+
+    /// Reads the meta/write_behind configuration node.
+    static WriteBehindOptions write_behind_options(YAML::Node config)
+    {
+        WriteBehindOptions options;
+        if (config["capacity"])
+            options.capacity = config["capacity"].as<std::size_t>();
+        if (config["batch_size"])
+            options.batch_size = config["batch_size"].as<std::size_t>();
+        if (config["flush_interval_ms"])
+            options.flush_interval = std::chrono::milliseconds(config["flush_interval_ms"].as<long>());
+        if (config["overflow"] && config["overflow"].as<std::string>() == "drop")
+            options.overflow_policy = OverflowPolicy::drop;
+        if (YAML::Node adaptive = config["adaptive"])
+        {
+            options.adaptive.enabled = true;
+            if (adaptive["goal"] && adaptive["goal"].as<std::string>() == "throughput")
+                options.adaptive.goal = BatchGoal::throughput;
+            if (adaptive["target_latency_ms"])
+                options.adaptive.target_latency = std::chrono::milliseconds(adaptive["target_latency_ms"].as<long>());
+            if (adaptive["min_batch"])
+                options.adaptive.min_batch = adaptive["min_batch"].as<std::size_t>();
+            if (adaptive["max_batch"])
+                options.adaptive.max_batch = adaptive["max_batch"].as<std::size_t>();
+            if (adaptive["min_interval_ms"])
+                options.adaptive.min_interval = std::chrono::milliseconds(adaptive["min_interval_ms"].as<long>());
+            if (adaptive["max_interval_ms"])
+                options.adaptive.max_interval = std::chrono::milliseconds(adaptive["max_interval_ms"].as<long>());
+            if (adaptive["window"])
+                options.adaptive.window = adaptive["window"].as<std::size_t>();
+        }
+        return options;
+    }
+
+    /// Reads the health check and reconnection settings of the pool from the meta: node.
+    static PoolOptions pool_options(YAML::Node meta)
+    {
+        PoolOptions options;
+        if (meta && meta["health_interval_ms"])
+            options.health_interval = std::chrono::milliseconds(meta["health_interval_ms"].as<long>());
+        if (meta && meta["retries"])
+            options.retries = meta["retries"].as<std::size_t>();
+        return options;
+    }
+
+    void connect(
+        YAML::Node connection_config, std::size_t open_connections = 1, const PoolOptions& options = PoolOptions())
+    {
+        try
+        {
+            connection_string_ = connection_string(connection_config);
+
+            std::shared_ptr<ConnectionPool> buff(new ConnectionPool(connection_string_, open_connections, options));
+            pool_ = buff;
+            load_typnames();
+
+        } catch (const std::exception& e)
+        {
+            std::cerr << e.what() << '\n';
+        }
+    };
+
+    /// Builds a connection string from the key/values of config, replaced or completed by those of overrides.
+    static std::string connection_string(YAML::Node config, YAML::Node overrides = YAML::Node())
+    {
+        std::stringstream ss;
+        for (YAML::const_iterator it = config.begin(); it != config.end(); ++it)
+        {
+            std::string key = it->first.as<std::string>();
+            if (!overrides || !overrides[key])
+                ss << key << "=" << it->second.as<std::string>() << " ";
+        }
+        if (overrides)
+            for (YAML::const_iterator it = overrides.begin(); it != overrides.end(); ++it)
+                ss << it->first.as<std::string>() << "=" << it->second.as<std::string>() << " ";
+        return ss.str();
+    }
+
+    /// Opens one pool per entry of replicas:, each entry replacing keys of the connection: block (usually host).
+    /// Replicas prefer standby servers (target_session_attrs=prefer-standby) unless either block sets it.
+    void connect_replicas(
+        YAML::Node connection_config, YAML::Node replicas, std::size_t replica_connections, const PoolOptions& options)
+    {
+        for (std::size_t i = 0; i < replicas.size(); i++)
+        {
+            try
+            {
+                std::string replica_string = connection_string(connection_config, replicas[i]);
+                if (!replicas[i]["target_session_attrs"] && !connection_config["target_session_attrs"])
+                    replica_string += "target_session_attrs=prefer-standby ";
+                replicas_.emplace_back(new ConnectionPool(replica_string, replica_connections, options));
+            } catch (const std::exception& e)
+            {
+                std::cerr << "\nError : " << e.what() << "was raised while connecting to replica " << i << '\n';
+            }
+        }
+    }
+
+    /// Pool serving reads: the replica with the fewest borrowed connections, or the next one with
+    /// meta/read_balancing: round_robin. Replicas whose connections are all lost are skipped, the primary pool is
+    /// used when there is none left.
+    ConnectionPool& read_pool()
+    {
+        std::size_t n = replicas_.size();
+        std::size_t first = round_robin_reads_ ? next_replica_.fetch_add(1, std::memory_order_relaxed) : 0;
+        ConnectionPool* best = nullptr;
+        std::size_t best_load = 0;
+        for (std::size_t i = 0; i < n; i++)
+        {
+            ConnectionPool& replica = *replicas_[(first + i) % n];
+            if (replica.lost() == replica.size())
+                continue;
+            if (round_robin_reads_)
+                return replica;
+            std::size_t load = replica.in_use();
+            if (!best || load < best_load)
+            {
+                best = &replica;
+                best_load = load;
+            }
+        }
+        return best ? *best : *pool_;
+    }
+
+    /// Runs f(lease) on a connection of read_pool(). Statements handing rows to a callback pass retry = false, so
+    /// that no row is handed out twice.
+    template <typename F>
+    void run_read(F&& f, bool retry = true)
+    {
+        ConnectionPool& pool = read_pool();
+        if (retry)
+            pool.run(f);
+        else
+        {
+            ConnectionPool::Lease c = pool.acquire();
+            f(c);
+        }
+    }
+
+    void explore_tables(YAML::Node tables) { explore_tables(table_names(tables)); }
+
+    /// Reads a YAML sequence of table names.
+    static std::vector<std::string> table_names(YAML::Node tables)
+    {
+        std::vector<std::string> table_names;
+        try
+        {
+            for (std::size_t i = 0; i < tables.size(); i++)
+                table_names.push_back(tables[i].as<std::string>());
+        } catch (const std::exception& e)
+        {
+            std::cerr << e.what() << '\n';
+        }
+        return table_names;
+    }
+
+    /// Explores a set of tables with a single pg_catalog query returning their columns in table order,
+    /// the column types and the primary keys.
+    void explore_tables(const std::vector<std::string>& table_names)
+    {
+        explore_tables(table_names, [this](const std::string& query) {
+            StatementTimer timer(metrics_.get(), "", Operation::other);
+            timer.built(query.size());
+            pqxx::result r = execute(query, timer);
+            if (!timer.ok())
+                throw std::runtime_error("the exploration query failed\n");
+            return r;
+        });
+    }
+
+    /// Explores a set of tables, running the pg_catalog query with run_query(query), which throws if it fails.
+    /// Only the tables whose query succeeded are published, the others stay unknown.
+    template <typename Query>
+    void explore_tables(const std::vector<std::string>& table_names, Query&& run_query)
+    {
+        std::vector<std::string> names;
+        std::unordered_set<std::string> seen;
+        for (auto const& table_name : table_names)
+            if (!schemas_.find(table_name) && seen.insert(table_name).second)
+                names.push_back(table_name);
+        if (names.empty())
+            return;
+
+        std::unordered_map<std::string, TableSchema> explored;
+        if (explore_columns(names, explored, run_query))
+            publish_schemas(std::move(explored));
+        else if (names.size() > 1)
+        {
+            // A single malformed name fails the whole query: each table is explored alone so that only it is lost
+            for (const std::string& table_name : names)
+            {
+                std::unordered_map<std::string, TableSchema> one;
+                if (explore_columns(std::vector<std::string>{table_name}, one, run_query))
+                    publish_schemas(std::move(one));
+            }
+        }
+    }
+
+    /// Fills explored with the columns of the tables named, read by one pg_catalog query run with run_query(query).
+    /// Returns false, reporting the error, if the query failed.
+    template <typename Query>
+    bool explore_columns(const std::vector<std::string>& names,
+        std::unordered_map<std::string, TableSchema>& explored,
+        Query& run_query)
+    {
+        try
+        {
+            for (auto const& table_name : names)
+            {
+                TableSchema& schema = explored[table_name];
+                std::stringstream ss(table_name);
+                std::getline(ss, schema.schema, '.');
+                std::getline(ss, schema.table, '.');
+            }
+
+            pqxx::result r = run_query(utl::string_format(
+                "SELECT q.name, a.attname, a.atttypid, t.typname, a.attnum = i.indkey[0] "
+                "FROM unnest(%s) AS q(name) "
+                "JOIN pg_catalog.pg_attribute a ON a.attrelid = to_regclass(q.name) "
+                "  AND a.attnum > 0 AND NOT a.attisdropped "
+                "JOIN pg_catalog.pg_type t ON t.oid = a.atttypid "
+                "LEFT JOIN pg_catalog.pg_index i ON i.indrelid = a.attrelid AND i.indisprimary "
+                "ORDER BY q.name, a.attnum",
+                utl::text_array_literal(names)));
+
+            for (auto const& row : r)
+            {
+                TableSchema& schema = explored[row[0].as<std::string>()];
+                if (!row[4].is_null() && row[4].as<bool>())
+                    schema.primary_key = int(schema.column_names.size());
+                schema.column_names.push_back(row[1].as<std::string>());
+                schema.column_types.push_back(row[2].as<pqxx::oid>());
+                schema.column_typnames.push_back(row[3].as<std::string>());
+            }
+            return true;
+        } catch (const std::exception& e)
+        {
+            std::cerr << "\nError : " << e.what() << "was raised while exploring "
+                      << (names.size() == 1 ? names[0] : std::to_string(names.size()) + " tables") << '\n';
+            return false;
+        }
+    }
+
+    /// Compiles and publishes explored schemas, exporting them to the configuration. A table without columns does
+    /// not exist (yet): it is left unknown, to be explored again on its next use.
+    void publish_schemas(std::unordered_map<std::string, TableSchema>&& explored)
+    {
+        try
+        {
+            for (auto it = explored.begin(); it != explored.end();)
+            {
+                auto& [table_name, schema] = *it;
+                if (schema.column_names.empty())
+                {
+                    std::cerr << "Warning : no column found for table " << table_name << '\n';
+                    it = explored.erase(it);
+                    continue;
+                }
+                schema.compile(table_name);
+                export_table_schema(table_name, schema);
+                ++it;
+            }
+            schemas_.publish(std::move(explored));
+        } catch (const std::exception& e)
+        {
+            std::cerr << e.what() << '\n';
+        }
+    }
+
+    void get_column_details(const std::string& table_name) { explore_tables(std::vector<std::string>{table_name}); }
+
+    /// Explores tables from a schema snapshot file when its fingerprint matches the current catalog,
+    /// otherwise explores them from the database and rewrites the snapshot.
+    void explore_tables_cached(YAML::Node tables, const std::string& snapshot_file)
+    {
+        std::vector<std::string> table_names = DatabaseWorker::table_names(tables);
+        std::string fingerprint = schema_fingerprint(table_names);
+        if (!fingerprint.empty() && load_schema_snapshot(snapshot_file, fingerprint))
+            return;
+        explore_tables(table_names);
+        if (!fingerprint.empty())
+            save_schema_snapshot(snapshot_file, fingerprint, table_names);
+    }
+
+    /// Cheap digest of the catalog rows describing a set of tables: it changes whenever one of them is created,
+    /// dropped or altered (pg_class, pg_attribute) or gets a different primary key (pg_index).
+    std::string schema_fingerprint(const std::vector<std::string>& table_names)
+    {
+        pqxx::result r = execute(utl::string_format(
+            "SELECT md5(string_agg(q.name || ':' || coalesce(c.oid::text, '-') || ':' || coalesce(c.xmin::text, '-') "
+            "  || ':' || coalesce((SELECT max(a.xmin::text::bigint)::text FROM pg_catalog.pg_attribute a "
+            "                      WHERE a.attrelid = c.oid), '-') "
+            "  || ':' || coalesce((SELECT string_agg(i.indexrelid::text || '.' || i.xmin::text, '.') "
+            "                      FROM pg_catalog.pg_index i WHERE i.indrelid = c.oid AND i.indisprimary), '-'), "
+            "  ',' ORDER BY q.name)) "
+            "FROM unnest(%s) AS q(name) LEFT JOIN pg_catalog.pg_class c ON c.oid = to_regclass(q.name)",
+            utl::text_array_literal(table_names)));
+        if (r.empty() || r[0][0].is_null())
+            return "";
+        return r[0][0].as<std::string>();
+    }
+
+    /// Loads the table schemas of a snapshot file. Returns false if the file is missing, unreadable or was
+    /// written for another catalog fingerprint.
+    bool load_schema_snapshot(const std::string& snapshot_file, const std::string& fingerprint)
+    {
+        try
+        {
+            std::ifstream fin(snapshot_file);
+            if (!fin)
+                return false;
+            YAML::Node snapshot = YAML::Load(fin);
+            if (!snapshot["fingerprint"] || snapshot["fingerprint"].as<std::string>() != fingerprint)
+                return false;
+
+            std::unordered_map<std::string, TableSchema> loaded;
+            for (YAML::const_iterator it = snapshot["tables"].begin(); it != snapshot["tables"].end(); ++it)
+            {
+                const std::string table_name = it->first.as<std::string>();
+                TableSchema& schema = loaded[table_name];
+                schema.schema = it->second["schema"].as<std::string>();
+                schema.table = it->second["table"].as<std::string>();
+                schema.primary_key = it->second["primary_key"].as<int>();
+                for (auto const& column : it->second["columns"])
+                {
+                    schema.column_names.push_back(column["name"].as<std::string>());
+                    schema.column_types.push_back(column["oid"].as<pqxx::oid>());
+                    schema.column_typnames.push_back(column["typname"].as<std::string>());
+                }
+                if (schema.column_names.empty())
+                    loaded.erase(table_name);
+                else
+                    schema.compile(table_name);
+            }
+            for (auto& [table_name, schema] : loaded)
+                export_table_schema(table_name, schema);
+            schemas_.publish(std::move(loaded));
+            return true;
+        } catch (const std::exception& e)
+        {
+            std::cerr << "Warning : ignoring schema snapshot " << snapshot_file << " (" << e.what() << ")\n";
+            return false;
+        }
+    }
+
+    /// Writes the schemas of a set of explored tables to a snapshot file, tagged with a catalog fingerprint.
+    void save_schema_snapshot(const std::string& snapshot_file,
+        const std::string& fingerprint,
+        const std::vector<std::string>& table_names)
+    {
+        try
+        {
+            YAML::Node snapshot;
+            snapshot["fingerprint"] = fingerprint;
+            for (auto const& table_name : table_names)
+            {
+                const TableSchema* found = schemas_.find(table_name);
+                if (!found)
+                    continue;
+                const TableSchema& schema = *found;
+                YAML::Node details = snapshot["tables"][table_name];
+                details["schema"] = schema.schema;
+                details["table"] = schema.table;
+                details["primary_key"] = schema.primary_key;
+                for (size_t i = 0; i < schema.column_names.size(); i++)
+                {
+                    YAML::Node column;
+                    column["name"] = schema.column_names[i];
+                    column["oid"] = schema.column_types[i];
+                    column["typname"] = schema.column_typnames[i];
+                    details["columns"].push_back(column);
+                }
+            }
+            std::ofstream fout;
+            fout.open(snapshot_file);
+            fout << snapshot << "\n";
+            fout.close();
+        } catch (const std::exception& e)
+        {
+            std::cerr << e.what() << '\n';
+        }
+    }
+
+    /// Mirrors a table schema under tables_details in db_config_, so that drop_config_yaml exports it.
+    void export_table_schema(const std::string& table_name, const TableSchema& schema)
+    {
+        std::lock_guard<std::mutex> guard(config_mutex_);
+        YAML::Node details = db_config_["tables_details"][table_name];
+        details["schema"] = schema.schema;
+        details["table"] = schema.table;
+        for (size_t i = 0; i < schema.column_names.size(); i++)
+            details["columns"][schema.column_names[i]] = schema.column_typnames[i];
+        details["primary_key"] = schema.primary_key_name();
+    }
+
+    /// Loads the whole pg_type catalog in the typname cache, in a single statement.
+    void load_typnames()
+    {
+        pqxx::result r = execute("SELECT t.oid, t.typname FROM pg_type t");
+        std::unique_lock<std::shared_mutex> guard(typnames_mutex_);
+        for (auto const& row : r)
+            typnames_[row[0].as<pqxx::oid>()] = row[1].as<std::string>();
+    }
+
+    /// Returns the type name of an oid from the typname cache, querying pg_type only on a miss.
+    /// Returned references stay valid for the lifetime of the worker since entries are never removed.
+    const std::string& get_typname_from_oid(pqxx::oid oid)
+    {
+        {
+            std::shared_lock<std::shared_mutex> guard(typnames_mutex_);
+            auto it = typnames_.find(oid);
+            if (it != typnames_.end())
+                return it->second;
+        }
+        pqxx::row row = execute1(utl::string_format("SELECT t.typname FROM pg_type t WHERE t.oid = %u", oid));
+        std::unique_lock<std::shared_mutex> guard(typnames_mutex_);
+        return typnames_.emplace(oid, row.size() ? row[0].as<std::string>() : std::string()).first->second;
+    }
+
+    void drop_config_yaml(const std::string& output_file)
+    {
+        try
+        {
+            std::lock_guard<std::mutex> guard(config_mutex_);
+            std::ofstream fout;
+            fout.open(output_file);
+            fout << db_config_ << "\n";
+            fout.close();
+        } catch (const std::exception& e)
+        {
+            std::cerr << e.what() << '\n';
+        }
+    }
+
+    /// Appends "INSERT INTO table_name (columns) VALUES (", without the column list if the table is unknown.
+    void append_insert_prefix(utl::SqlBuffer& buf, const std::string& table_name) const
+    {
+        if (const TableSchema* schema = schemas_.find(table_name))
+            buf.append(schema->insert_prefix);
+        else
+            buf.append("INSERT INTO ").append(table_name).append(" VALUES (");
+    }
+
+    /// Returns the prepared INSERT of num_values parameters into a table.
+    /// Definitions are built once per (table, number of values) and shared by every connection of the pool.
+    const PreparedStatement& prepared_insert(const std::string& table_name, size_t num_values)
+    {
+        {
+            std::shared_lock<std::shared_mutex> guard(statements_mutex_);
+            auto it = prepared_inserts_.find(table_name);
+            if (it != prepared_inserts_.end())
+            {
+                auto statement = it->second.find(num_values);
+                if (statement != it->second.end())
+                    return statement->second;
+            }
+        }
+        const TableSchema& schema = table_schema(table_name);
+        utl::SqlBuffer::Lease buf;
+        buf->append(schema.insert_prefix);
+        for (size_t i = 1; i <= num_values; i++)
+            buf->append('$').append_number(i).append(", ");
+        buf->drop_last(2).append(')');
+        PreparedStatement statement{PreparedStatement::next_name(), buf->str(), {}};
+        std::size_t typed = std::min(num_values, schema.insert_types.size());
+        statement.param_types.assign(schema.insert_types.begin(), schema.insert_types.begin() + typed);
+
+        std::unique_lock<std::shared_mutex> guard(statements_mutex_);
+        return prepared_inserts_[table_name].emplace(num_values, std::move(statement)).first->second;
+    }
+
+    /// Returns the prepared INSERT of the columns of a PGI_ROW struct into a table.
+    template <typename T>
+    const PreparedStatement& prepared_row_insert(const std::string& table_name)
+    {
+        constexpr auto columns = utl::row_traits<T>::columns;
+        std::string key = table_name;
+        key += ' ';
+        key.append(columns.data, columns.size);
+        {
+            std::shared_lock<std::shared_mutex> guard(statements_mutex_);
+            auto it = prepared_row_inserts_.find(key);
+            if (it != prepared_row_inserts_.end())
+                return it->second;
+        }
+        utl::SqlBuffer::Lease buf;
+        buf->append("INSERT INTO ").append(table_name).append(" (").append(columns.view()).append(") VALUES (");
+        for (size_t i = 1; i <= utl::row_traits<T>::size; i++)
+            buf->append('$').append_number(i).append(", ");
+        buf->drop_last(2).append(')');
+        PreparedStatement statement{PreparedStatement::next_name(), buf->str(), {}};
+        const TableSchema& schema = table_schema(table_name);
+        for (std::string_view column : utl::split_columns(columns.view()))
+        {
+            int index = schema.column_index(std::string(column));
+            statement.param_types.push_back(index < 0 ? 0 : schema.column_types[index]);
+        }
+
+        std::unique_lock<std::shared_mutex> guard(statements_mutex_);
+        return prepared_row_inserts_.emplace(std::move(key), std::move(statement)).first->second;
+    }
+
+    void explore_if_unknown(const std::string& table_name) { table_schema(table_name); }
+
+    /// Returns false, reporting it, if a table explored by the caller is still unknown: the prepared statements,
+    /// built once from its schema, would stay wrong once it exists.
+    bool known_table(const std::string& table_name) const
+    {
+        if (schemas_.find(table_name))
+            return true;
+        std::cerr << "\nError : table " << table_name << " is unknown\n";
+        return false;
+    }
+
+    /// Adds a table explored on first use to the tables: list of db_config_, once.
+    void list_table(const std::string& table_name)
+    {
+        std::lock_guard<std::mutex> guard(config_mutex_);
+        YAML::Node tables = db_config_["tables"];
+        for (std::size_t i = 0; i < tables.size(); i++)
+            if (tables[i].as<std::string>() == table_name)
+                return;
+        tables.push_back(table_name);
+    }
+
+    /// Returns the schema of a table already explored, or an empty schema, without exploring it.
+    const TableSchema& known_schema(const std::string& table_name) const
+    {
+        static const TableSchema unknown;
+        const TableSchema* schema = schemas_.find(table_name);
+        return schema ? *schema : unknown;
+    }
+
+    /// Returns the schema of a table, exploring it first if it is unknown (an empty schema if that failed or if the
+    /// table does not exist, explored again on the next call).
+    /// Known tables are found without any lock; the wait for the exploration of an unknown one is recorded as
+    /// Operation::schema_lock.
+    const TableSchema& table_schema(const std::string& table_name)
+    {
+        if (const TableSchema* schema = schemas_.find(table_name))
+            return *schema;
+        static const TableSchema unknown;
+        StatementTimer timer(metrics_.get(), "", Operation::schema_lock);
+        const TableSchema* schema = schemas_.find_or_explore(table_name, [&] {
+            list_table(table_name);
+            get_column_details(table_name);
+        });
+        timer.acquired();
+        return schema ? *schema : unknown;
+    }
+
+    /// Returns the schema of a table, exploring it first with run_query(query) if it is unknown, or null if that
+    /// failed. Used by Pipeline and Transaction, which hold a pooled connection: exploring on another one could wait
+    /// for it forever. For the same reason the exploration does not wait for the one of another caller, the table
+    /// may be explored twice.
+    template <typename Query>
+    const TableSchema* table_schema(const std::string& table_name, Query&& run_query)
+    {
+        if (const TableSchema* schema = schemas_.find(table_name))
+            return schema;
+        list_table(table_name);
+        explore_tables(std::vector<std::string>{table_name}, run_query);
+        return schemas_.find(table_name);
+    }
+
+    /// Async executor, opened by enable_async() or by the first *_async call.
+    std::shared_ptr<AsyncExecutor> async_executor()
+    {
+        std::lock_guard<std::mutex> guard(async_mutex_);
+        if (!async_)
+            async_.reset(new AsyncExecutor(connection_string_, pool_ ? pool_->size() : 1));
+        return async_;
+    }
+
+    std::string connection_string_;
+    std::shared_ptr<ConnectionPool> pool_;
+    std::vector<std::shared_ptr<ConnectionPool>> replicas_;
+    std::atomic<std::size_t> next_replica_{0};
+    bool round_robin_reads_ = false;
+    // Declared before them so that it outlives the write-behind and async threads invalidating it
+    std::shared_ptr<ResultCache> cache_;
+    // Read and replaced with std::atomic_load/std::atomic_store, since inserts run while write-behind is toggled
+    std::shared_ptr<WriteBehindQueue> write_behind_;
+    std::shared_ptr<AsyncExecutor> async_;
+    std::shared_ptr<Metrics> metrics_;
+    std::mutex async_mutex_;
 
 protected:
     YAML::Node db_config_;
-    std::mutex mutex_;
+    /// Explored tables by name. Entries are never removed, so references to them stay valid.
+    SchemaRegistry schemas_;
+    /// Guards the writes to db_config_, which is only read at construction.
+    std::mutex config_mutex_;
+    /// Printed width per type name, from field_length_mapping.
+    std::unordered_map<std::string, std::size_t> field_widths_;
+    /// Cache of pg_type, shared by every thread using this worker.
+    std::unordered_map<pqxx::oid, std::string> typnames_;
+    std::shared_mutex typnames_mutex_;
+    /// Prepared INSERT statements by table and number of values.
+    std::unordered_map<std::string, std::map<size_t, PreparedStatement>> prepared_inserts_;
+    /// Prepared INSERT statements of PGI_ROW structs by table and column list.
+    std::unordered_map<std::string, PreparedStatement> prepared_row_inserts_;
+    std::shared_mutex statements_mutex_;
+
+    // Declared last so that the handlers have stopped before the members they may use are destroyed
+    std::shared_ptr<NotificationListener> listener_;
+    std::mutex listener_mutex_;
 };
 
 }  // namespace pgi
\ No newline at end of file
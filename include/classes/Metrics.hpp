@@ -0,0 +1,424 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pgi {
+
+/// Lock free latency histogram in nanoseconds with log-linear buckets: 8 buckets per power of two, so that any
+/// recorded value is known within 12.5%. Values from 0 to about an hour are kept, larger ones go in the last bucket.
+class LatencyHistogram
+{
+public:
+    static constexpr int sub_buckets = 8;
+    static constexpr int size = 41 * sub_buckets;
+
+    void record(std::uint64_t ns)
+    {
+        buckets_[index(ns)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(ns, std::memory_order_relaxed);
+        std::uint64_t max = max_.load(std::memory_order_relaxed);
+        while (ns > max && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    std::uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    std::uint64_t bucket(int i) const { return buckets_[i].load(std::memory_order_relaxed); }
+
+    /// Largest value of bucket i.
+    static std::uint64_t upper_bound(int i)
+    {
+        if (i < sub_buckets)
+            return std::uint64_t(i);
+        int shift = i / sub_buckets - 1;
+        std::uint64_t mantissa = std::uint64_t(i % sub_buckets + sub_buckets);
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    /// Value below which a fraction q of the recorded values fall, within the bucket precision.
+    std::uint64_t percentile(double q) const
+    {
+        std::uint64_t total = count();
+        if (total == 0)
+            return 0;
+        std::uint64_t rank = std::uint64_t(q * double(total));
+        std::uint64_t seen = 0;
+        for (int i = 0; i < size; i++)
+        {
+            seen += bucket(i);
+            if (seen > rank)
+                return std::min(upper_bound(i), max());
+        }
+        return max();
+    }
+
+private:
+    static int index(std::uint64_t ns)
+    {
+        if (ns < std::uint64_t(sub_buckets))
+            return int(ns);
+        int msb = 63 - __builtin_clzll(ns);
+        int i = (msb - 2) * sub_buckets + int(ns >> (msb - 3)) - sub_buckets;
+        return i < size ? i : size - 1;
+    }
+
+    std::array<std::atomic<std::uint64_t>, size> buckets_ = {};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
+
+/// Kind of statement the metrics are kept for.
+enum class Operation
+{
+    select,
+    insert,
+    bulk,
+    update,
+    other,
+    /// Waits for the exploration of an unknown table (DatabaseWorker::table_schema), recorded as the wait phase.
+    schema_lock
+};
+
+inline const char* operation_name(Operation op)
+{
+    switch (op)
+    {
+        case Operation::select: return "select";
+        case Operation::insert: return "insert";
+        case Operation::bulk: return "bulk";
+        case Operation::update: return "update";
+        case Operation::schema_lock: return "schema_lock";
+        default: return "other";
+    }
+}
+
+/// Counters and phase latencies of one (table, operation).
+struct OperationMetrics
+{
+    std::string table;
+    Operation operation;
+    std::atomic<std::uint64_t> statements{0};
+    std::atomic<std::uint64_t> errors{0};
+    std::atomic<std::uint64_t> rows{0};
+    std::atomic<std::uint64_t> bytes_sent{0};
+    /// Selects served by the result cache, counted apart from the statements.
+    std::atomic<std::uint64_t> cache_hits{0};
+    /// Building the SQL text or the parameters on the client.
+    LatencyHistogram build;
+    /// Waiting for a pooled connection (or for the exploration of a table).
+    LatencyHistogram wait;
+    /// Sending the statement and receiving its result.
+    LatencyHistogram execute;
+    LatencyHistogram commit;
+    LatencyHistogram total;
+};
+
+/// Plain copy of a histogram, in nanoseconds.
+struct LatencySummary
+{
+    std::uint64_t count = 0;
+    std::uint64_t sum = 0;
+    std::uint64_t p50 = 0;
+    std::uint64_t p90 = 0;
+    std::uint64_t p99 = 0;
+    std::uint64_t max = 0;
+};
+
+/// Plain copy of the metrics of one (table, operation).
+struct OperationSnapshot
+{
+    std::string table;
+    std::string operation;
+    std::uint64_t statements = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t rows = 0;
+    std::uint64_t bytes_sent = 0;
+    std::uint64_t cache_hits = 0;
+    LatencySummary build;
+    LatencySummary wait;
+    LatencySummary execute;
+    LatencySummary commit;
+    LatencySummary total;
+};
+
+/// Batch size and flush interval chosen for the write-behind rows of one table, see BatchController.
+struct BatchDecision
+{
+    std::string table;
+    std::size_t batch_size = 0;
+    std::chrono::milliseconds flush_interval{0};
+    /// Measured over the last adjustment window.
+    std::chrono::microseconds p99_commit{0};
+    /// Rows committed per second spent writing, over the last adjustment window.
+    double rows_per_second = 0;
+    /// Rows queued per second, over the last adjustment window.
+    double arrival_rate = 0;
+    std::uint64_t adjustments = 0;
+};
+
+/// Registry of the metrics of every (table, operation) used by a DatabaseWorker, see DatabaseWorker::enable_metrics().
+/// Entries are created on first use and never removed, recording does not take any lock.
+class Metrics
+{
+public:
+    OperationMetrics& operation(const std::string& table, Operation op)
+    {
+        std::string key = table;
+        key += '\n';
+        key += operation_name(op);
+        {
+            std::shared_lock<std::shared_mutex> guard(mutex_);
+            auto it = operations_.find(key);
+            if (it != operations_.end())
+                return *it->second;
+        }
+        std::unique_lock<std::shared_mutex> guard(mutex_);
+        std::unique_ptr<OperationMetrics>& entry = operations_[key];
+        if (!entry)
+        {
+            entry.reset(new OperationMetrics());
+            entry->table = table;
+            entry->operation = op;
+        }
+        return *entry;
+    }
+
+    std::vector<OperationSnapshot> snapshot() const
+    {
+        std::vector<OperationSnapshot> snapshots;
+        std::shared_lock<std::shared_mutex> guard(mutex_);
+        for (auto const& [key, m] : operations_)
+        {
+            OperationSnapshot s;
+            s.table = m->table;
+            s.operation = operation_name(m->operation);
+            s.statements = m->statements.load();
+            s.errors = m->errors.load();
+            s.rows = m->rows.load();
+            s.bytes_sent = m->bytes_sent.load();
+            s.cache_hits = m->cache_hits.load();
+            s.build = summary(m->build);
+            s.wait = summary(m->wait);
+            s.execute = summary(m->execute);
+            s.commit = summary(m->commit);
+            s.total = summary(m->total);
+            snapshots.push_back(std::move(s));
+        }
+        return snapshots;
+    }
+
+    /// Publishes the latest decision of the adaptive batching of a table.
+    void batch_decision(const BatchDecision& decision)
+    {
+        std::unique_lock<std::shared_mutex> guard(mutex_);
+        batches_[decision.table] = decision;
+    }
+
+    std::vector<BatchDecision> batch_decisions() const
+    {
+        std::vector<BatchDecision> decisions;
+        std::shared_lock<std::shared_mutex> guard(mutex_);
+        for (auto const& [table, d] : batches_)
+            decisions.push_back(d);
+        return decisions;
+    }
+
+    /// Every metric in the Prometheus text exposition format.
+    std::string prometheus() const
+    {
+        static const double bounds[] = {1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 5e-3, 1e-2, 5e-2, 0.1, 0.5, 1, 5, 10};
+        std::ostringstream ss;
+        std::shared_lock<std::shared_mutex> guard(mutex_);
+
+        auto counter = [&](const char* name, const char* help, std::atomic<std::uint64_t> OperationMetrics::*field) {
+            ss << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " counter\n";
+            for (auto const& [key, m] : operations_)
+                ss << name << '{' << labels(*m) << "} " << ((*m).*field).load() << '\n';
+        };
+        counter("pgi_statements_total", "Statements run.", &OperationMetrics::statements);
+        counter("pgi_statement_errors_total", "Statements that failed.", &OperationMetrics::errors);
+        counter("pgi_rows_total", "Rows returned, inserted, updated or copied.", &OperationMetrics::rows);
+        counter("pgi_bytes_sent_total", "Bytes of SQL text and COPY data sent.", &OperationMetrics::bytes_sent);
+        counter("pgi_cache_hits_total", "Selects served by the result cache.", &OperationMetrics::cache_hits);
+
+        const char* name = "pgi_statement_duration_seconds";
+        ss << "# HELP " << name << " Time spent in each phase of a statement.\n# TYPE " << name << " histogram\n";
+        const std::pair<const char*, LatencyHistogram OperationMetrics::*> phases[] = {
+            {"build", &OperationMetrics::build},
+            {"wait", &OperationMetrics::wait},
+            {"execute", &OperationMetrics::execute},
+            {"commit", &OperationMetrics::commit},
+            {"total", &OperationMetrics::total}};
+        for (auto const& [key, m] : operations_)
+        {
+            for (auto const& [phase, field] : phases)
+            {
+                const LatencyHistogram& h = (*m).*field;
+                if (h.count() == 0)
+                    continue;
+                std::string l = labels(*m) + ",phase=\"" + phase + "\"";
+                std::uint64_t cumulative = 0;
+                int i = 0;
+                for (double bound : bounds)
+                {
+                    for (; i < LatencyHistogram::size && double(LatencyHistogram::upper_bound(i)) <= bound * 1e9; i++)
+                        cumulative += h.bucket(i);
+                    ss << name << "_bucket{" << l << ",le=\"" << bound << "\"} " << cumulative << '\n';
+                }
+                ss << name << "_bucket{" << l << ",le=\"+Inf\"} " << h.count() << '\n';
+                ss << name << "_sum{" << l << "} " << double(h.sum()) * 1e-9 << '\n';
+                ss << name << "_count{" << l << "} " << h.count() << '\n';
+            }
+        }
+
+        auto gauge = [&](const char* name, const char* help, auto value) {
+            if (batches_.empty())
+                return;
+            ss << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " gauge\n";
+            for (auto const& [table, d] : batches_)
+                ss << name << "{table=\"" << escaped(table) << "\"} " << value(d) << '\n';
+        };
+        gauge("pgi_write_behind_batch_size", "Queued rows triggering a write, chosen by the adaptive batching.",
+            [](const BatchDecision& d) { return d.batch_size; });
+        gauge("pgi_write_behind_flush_interval_seconds", "Longest wait of a queued row, chosen by adaptive batching.",
+            [](const BatchDecision& d) { return double(d.flush_interval.count()) * 1e-3; });
+        gauge("pgi_write_behind_commit_p99_seconds", "p99 write latency over the last adjustment window.",
+            [](const BatchDecision& d) { return double(d.p99_commit.count()) * 1e-6; });
+        gauge("pgi_write_behind_rows_per_second", "Rows committed per second of writing over the last window.",
+            [](const BatchDecision& d) { return d.rows_per_second; });
+        return ss.str();
+    }
+
+private:
+    static LatencySummary summary(const LatencyHistogram& h)
+    {
+        LatencySummary s;
+        s.count = h.count();
+        s.sum = h.sum();
+        s.p50 = h.percentile(0.5);
+        s.p90 = h.percentile(0.9);
+        s.p99 = h.percentile(0.99);
+        s.max = h.max();
+        return s;
+    }
+
+    static std::string labels(const OperationMetrics& m)
+    {
+        std::string l = "table=\"";
+        l += escaped(m.table);
+        l += "\",operation=\"";
+        l += operation_name(m.operation);
+        l += '"';
+        return l;
+    }
+
+    /// Label value with its quotes and backslashes escaped.
+    static std::string escaped(const std::string& value)
+    {
+        std::string e;
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\')
+                e += '\\';
+            e += c;
+        }
+        return e;
+    }
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, std::unique_ptr<OperationMetrics>> operations_;
+    std::unordered_map<std::string, BatchDecision> batches_;
+};
+
+/// Times the phases of one statement and records them when destroyed. Does nothing, without reading the clock,
+/// when metrics are disabled. Each phase lasts from the end of the previous one.
+class StatementTimer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    StatementTimer(Metrics* metrics, const std::string& table, Operation op)
+        : metrics_(metrics ? &metrics->operation(table, op) : nullptr)
+    {
+        if (metrics_)
+            start_ = last_ = clock::now();
+    }
+    StatementTimer(const StatementTimer&) = delete;
+    StatementTimer& operator=(const StatementTimer&) = delete;
+
+    ~StatementTimer()
+    {
+        if (!metrics_)
+            return;
+        if (cache_hit_)
+        {
+            metrics_->cache_hits.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        metrics_->total.record(elapsed(start_, clock::now()));
+        metrics_->statements.fetch_add(1, std::memory_order_relaxed);
+        metrics_->rows.fetch_add(rows_, std::memory_order_relaxed);
+        metrics_->bytes_sent.fetch_add(bytes_, std::memory_order_relaxed);
+        if (failed_)
+            metrics_->errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void built(std::size_t bytes)
+    {
+        bytes_ += bytes;
+        phase(&OperationMetrics::build);
+    }
+    /// Counts bytes sent outside of the built statement, e.g. COPY data.
+    void sent(std::size_t bytes) { bytes_ += bytes; }
+    void acquired() { phase(&OperationMetrics::wait); }
+    void executed(std::size_t rows = 0)
+    {
+        rows_ += rows;
+        phase(&OperationMetrics::execute);
+    }
+    void committed() { phase(&OperationMetrics::commit); }
+    void failed() { failed_ = true; }
+    /// Records the statement as served by the result cache instead of run: only the cache hit is counted.
+    void cache_hit() { cache_hit_ = true; }
+    /// False once failed() was called, whether metrics are enabled or not.
+    bool ok() const { return !failed_; }
+
+private:
+    static std::uint64_t elapsed(clock::time_point from, clock::time_point to)
+    {
+        return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+    }
+
+    void phase(LatencyHistogram OperationMetrics::*histogram)
+    {
+        if (!metrics_)
+            return;
+        clock::time_point now = clock::now();
+        (metrics_->*histogram).record(elapsed(last_, now));
+        last_ = now;
+    }
+
+    OperationMetrics* metrics_;
+    clock::time_point start_;
+    clock::time_point last_;
+    std::size_t rows_ = 0;
+    std::size_t bytes_ = 0;
+    bool failed_ = false;
+    bool cache_hit_ = false;
+};
+
+}  // namespace pgi
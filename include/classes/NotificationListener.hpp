@@ -0,0 +1,329 @@
+#pragma once
+#include <libpq-fe.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace pgi {
+
+/// Notification sent by NOTIFY or pg_notify() on a channel.
+struct Notification
+{
+    std::string channel;
+    std::string payload;
+    /// Process id of the server backend that sent it.
+    int backend_pid = 0;
+};
+
+/// Receives notifications on its own libpq connection, without polling the server.
+/// A background thread waits on the connection socket with poll() and calls the handlers subscribed to the channel
+/// of each notification as it arrives. Handlers run on that thread, one at a time, and may subscribe or unsubscribe.
+/// A lost connection is reset and every channel listened again; notifications sent meanwhile are lost.
+class NotificationListener
+{
+public:
+    using handler_t = std::function<void(const Notification&)>;
+
+    explicit NotificationListener(const std::string& connection_string)
+    {
+        if (pipe(wake_pipe_) != 0)
+            throw std::runtime_error("NotificationListener: cannot create its wake-up pipe");
+        fcntl(wake_pipe_[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake_pipe_[1], F_SETFL, O_NONBLOCK);
+
+        connection_ = PQconnectdb(connection_string.c_str());
+        if (PQstatus(connection_) != CONNECTION_OK)
+        {
+            std::string error = PQerrorMessage(connection_);
+            close();
+            throw std::runtime_error("NotificationListener: connection failed: " + error);
+        }
+        thread_ = std::thread(&NotificationListener::run, this);
+    }
+
+    NotificationListener(const NotificationListener&) = delete;
+    NotificationListener& operator=(const NotificationListener&) = delete;
+
+    ~NotificationListener()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake();
+        thread_.join();
+        close();
+    }
+
+    /// Calls handler with every notification on channel. The channel is listened to when this returns, except
+    /// when called from a handler while the LISTEN of another subscriber is still queued: it runs once the handler
+    /// returns. Returns the id to unsubscribe with.
+    std::size_t subscribe(const std::string& channel, handler_t handler)
+    {
+        const bool inline_listen = std::this_thread::get_id() == thread_.get_id();
+        std::size_t id;
+        std::promise<void> inline_done;
+        std::shared_future<void> listened;
+        bool first;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            id = next_id_++;
+            std::vector<Handler>& handlers = channels_[channel];
+            first = handlers.empty();
+            handlers.push_back(Handler{id, std::make_shared<handler_t>(std::move(handler))});
+            // Later subscribers wait for the LISTEN of the first one
+            if (first)
+                listened_[channel] = inline_listen ? inline_done.get_future().share() : queue("LISTEN", channel);
+            listened = listened_[channel];
+        }
+        if (first && inline_listen)
+        {
+            run_command("LISTEN", channel);
+            inline_done.set_value();
+        }
+        else if (first)
+            wake();
+        if (!inline_listen)
+            listened.wait();
+        return id;
+    }
+
+    /// Removes a handler, and stops listening to its channel once it has none left.
+    void unsubscribe(std::size_t id)
+    {
+        std::string channel;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto it = channels_.begin(); it != channels_.end(); ++it)
+            {
+                std::vector<Handler>& handlers = it->second;
+                for (auto h = handlers.begin(); h != handlers.end(); ++h)
+                {
+                    if (h->id != id)
+                        continue;
+                    handlers.erase(h);
+                    if (handlers.empty())
+                    {
+                        channel = it->first;
+                        listened_.erase(channel);
+                        channels_.erase(it);
+                    }
+                    break;
+                }
+                if (!channel.empty())
+                    break;
+            }
+        }
+        if (!channel.empty())
+            command("UNLISTEN", channel);
+    }
+
+    /// Number of notifications handed to the handlers.
+    std::uint64_t received() const { return received_.load(); }
+
+private:
+    struct Handler
+    {
+        std::size_t id;
+        // Shared so that a handler unsubscribed during a dispatch stays alive until it returns
+        std::shared_ptr<handler_t> call;
+    };
+
+    /// LISTEN or UNLISTEN run by the background thread, which owns the connection.
+    struct Command
+    {
+        std::string verb;
+        std::string channel;
+        std::promise<void> done;
+    };
+
+    /// Runs a command on the background thread and waits for it, or runs it inline from a handler.
+    void command(const std::string& verb, const std::string& channel)
+    {
+        if (std::this_thread::get_id() == thread_.get_id())
+        {
+            run_command(verb, channel);
+            return;
+        }
+        std::shared_future<void> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done = queue(verb, channel);
+        }
+        wake();
+        done.wait();
+    }
+
+    /// Queues a command for the background thread, mutex_ being held. Returns the future set once it ran.
+    std::shared_future<void> queue(const std::string& verb, const std::string& channel)
+    {
+        commands_.push_back(Command{verb, channel, std::promise<void>()});
+        return commands_.back().done.get_future().share();
+    }
+
+    bool run_command(const std::string& verb, const std::string& channel)
+    {
+        char* identifier = PQescapeIdentifier(connection_, channel.c_str(), channel.size());
+        if (!identifier)
+        {
+            std::cerr << "\nError : " << PQerrorMessage(connection_) << "was raised while quoting channel " << channel
+                      << '\n';
+            return false;
+        }
+        std::string statement = verb + " " + identifier;
+        PQfreemem(identifier);
+        PGresult* res = PQexec(connection_, statement.c_str());
+        bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+        if (!ok)
+            std::cerr << "\nError : " << PQresultErrorMessage(res) << "was raised while executing the following "
+                      << "statement : \n" << statement << '\n';
+        PQclear(res);
+        return ok;
+    }
+
+    void run()
+    {
+        for (;;)
+        {
+            std::deque<Command> commands;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stop_)
+                    break;
+                commands.swap(commands_);
+            }
+            for (Command& c : commands)
+            {
+                run_command(c.verb, c.channel);
+                c.done.set_value();
+            }
+            // Notifications read while a command ran are already queued by libpq
+            drain();
+
+            pollfd fds[2] = {{wake_pipe_[0], POLLIN, 0}, {PQsocket(connection_), POLLIN, 0}};
+            if (poll(fds, fds[1].fd < 0 ? 1 : 2, fds[1].fd < 0 ? 1000 : -1) < 0)
+                continue;
+            if (fds[0].revents & POLLIN)
+            {
+                char buffer[64];
+                while (read(wake_pipe_[0], buffer, sizeof(buffer)) > 0)
+                {
+                }
+            }
+            if (fds[1].fd >= 0 && !fds[1].revents && PQstatus(connection_) == CONNECTION_OK)
+                continue;
+            if (fds[1].fd < 0 || !PQconsumeInput(connection_) || PQstatus(connection_) == CONNECTION_BAD)
+            {
+                reconnect();
+                continue;
+            }
+            drain();
+        }
+        // Release the callers of commands queued during the shutdown
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (Command& c : commands_)
+            c.done.set_value();
+        commands_.clear();
+    }
+
+    void drain()
+    {
+        while (PGnotify* notify = PQnotifies(connection_))
+        {
+            Notification n{notify->relname, notify->extra ? notify->extra : "", notify->be_pid};
+            PQfreemem(notify);
+            dispatch(n);
+        }
+    }
+
+    void dispatch(const Notification& n)
+    {
+        std::vector<std::shared_ptr<handler_t>> handlers;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = channels_.find(n.channel);
+            if (it == channels_.end())
+                return;
+            for (const Handler& h : it->second)
+                handlers.push_back(h.call);
+        }
+        received_++;
+        for (const std::shared_ptr<handler_t>& handler : handlers)
+        {
+            try
+            {
+                (*handler)(n);
+            } catch (const std::exception& e)
+            {
+                std::cerr << "\nError : " << e.what() << "was raised by a handler of channel " << n.channel << '\n';
+            }
+        }
+    }
+
+    /// Resets the lost connection then listens again to every subscribed channel.
+    void reconnect()
+    {
+        std::cerr << "\nError : " << PQerrorMessage(connection_) << "was raised by the notification connection\n";
+        PQreset(connection_);
+        if (PQstatus(connection_) != CONNECTION_OK)
+        {
+            // Retried on the next poll timeout
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            return;
+        }
+        std::vector<std::string> channels;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto const& [channel, handlers] : channels_)
+                channels.push_back(channel);
+        }
+        for (const std::string& channel : channels)
+            run_command("LISTEN", channel);
+    }
+
+    void wake()
+    {
+        if (write(wake_pipe_[1], "", 1) < 0)
+        {
+            // The pipe is full: the background thread is already due to wake up
+        }
+    }
+
+    void close()
+    {
+        if (connection_)
+            PQfinish(connection_);
+        connection_ = nullptr;
+        ::close(wake_pipe_[0]);
+        ::close(wake_pipe_[1]);
+    }
+
+    PGconn* connection_ = nullptr;
+    std::unordered_map<std::string, std::vector<Handler>> channels_;
+    /// Set once the LISTEN of each subscribed channel ran.
+    std::unordered_map<std::string, std::shared_future<void>> listened_;
+    std::deque<Command> commands_;
+    std::mutex mutex_;
+    bool stop_ = false;
+    std::size_t next_id_ = 1;
+    std::atomic<std::uint64_t> received_{0};
+    int wake_pipe_[2] = {-1, -1};
+    std::thread thread_;
+};
+
+}  // namespace pgi
@@ -0,0 +1,173 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "classes/DatabaseWorker.hpp"
+
+namespace pgi {
+
+/// Session queueing statements on one pooled connection without waiting for each result.
+/// Statements are sent back-to-back through a pqxx::pipeline inside a single transaction; results are
+/// collected with retrieve() in any order, and the transaction is committed by commit().
+/// Obtained from DatabaseWorker::pipeline(). Unknown tables are explored through the pipeline itself, which waits
+/// for the statements queued before. Once committed, a pipeline throws pqxx::usage_error when used again.
+class Pipeline
+{
+public:
+    using query_id = pqxx::pipeline::query_id;
+
+    Pipeline(DatabaseWorker& worker, ConnectionPool::Lease&& connection)
+        : worker_(&worker),
+          connection_(std::move(connection)),
+          work_(new pqxx::work(*connection_)),
+          pipeline_(new pqxx::pipeline(*work_))
+    {
+    }
+
+    Pipeline(Pipeline&&) = default;
+
+    /// Queues a statement. Returns the id to retrieve its result with.
+    query_id execute(const std::string& statement) { return pipeline().insert(statement); }
+
+    query_id select(const std::string& table_name,
+        const std::vector<std::string> fields = std::vector<std::string>(),
+        const std::string& condition = "",
+        const std::string& order_by = "",
+        const int& limit = 10000)
+    {
+        explore(table_name);
+        utl::SqlBuffer::Lease buf;
+        worker_->select_statement(*buf, table_name, fields, condition, order_by);
+        buf->append(" LIMIT ").append_number(limit);
+        return execute(buf->str());
+    }
+
+    template <typename... Args>
+    query_id insert(const std::string& table_name, const Args&... values)
+    {
+        explore(table_name);
+        wrote(table_name);
+        utl::SqlBuffer::Lease buf;
+        worker_->insert_statement(*buf, table_name, values...);
+        return execute(buf->str());
+    }
+
+    template <typename... Args>
+    query_id insert_from_maps(const std::string& table_name, const Args&... maps)
+    {
+        explore(table_name);
+        wrote(table_name);
+        utl::SqlBuffer::Lease buf;
+        worker_->insert_from_maps_statement(*buf, table_name, maps...);
+        return execute(buf->str());
+    }
+
+    template <typename... Args>
+    query_id bulk_insert_from_maps(const std::string& table_name, const Args&... maps)
+    {
+        explore(table_name);
+        wrote(table_name);
+        utl::SqlBuffer::Lease buf;
+        worker_->bulk_insert_statement(*buf, table_name, maps...);
+        return execute(buf->str());
+    }
+
+    template <typename... Args>
+    query_id update_from_maps(const std::string& table_name, const std::string& condition, const Args&... maps)
+    {
+        explore(table_name);
+        wrote(table_name);
+        utl::SqlBuffer::Lease buf;
+        worker_->update_statement(*buf, table_name, condition, maps...);
+        return execute(buf->str());
+    }
+
+    /// Single UPDATE ... FROM (VALUES ...) of DatabaseWorker::bulk_update_from_maps, whatever the number of rows.
+    template <typename... Args>
+    query_id bulk_update_from_maps(const std::string& table_name, const std::string& key_column, const Args&... maps)
+    {
+        explore(table_name);
+        wrote(table_name);
+        utl::SqlBuffer::Lease buf;
+        worker_->bulk_update_statement(*buf, table_name,
+            key_column.empty() ? worker_->known_schema(table_name).primary_key_name() : key_column, maps...);
+        return execute(buf->str());
+    }
+
+    /// Returns true once the result of a queued statement is available.
+    bool is_finished(query_id id) { return pipeline().is_finished(id); }
+
+    /// Waits for the result of a queued statement. Returns an empty result if it failed.
+    pqxx::result retrieve(query_id id)
+    {
+        pqxx::pipeline& p = pipeline();
+        pqxx::result r;
+        try
+        {
+            r = p.retrieve(id);
+        } catch (const std::exception& e)
+        {
+            std::cerr << "\nError : " << e.what() << "was raised by a pipelined statement\n";
+        }
+        return r;
+    }
+
+    /// Waits for every queued statement then commits them. Returns false if the transaction failed.
+    /// Results must be retrieved before committing.
+    bool commit()
+    {
+        pqxx::pipeline& p = pipeline();
+        try
+        {
+            p.complete();
+            pipeline_.reset();
+            work_->commit();
+            for (const std::string& table_name : written_)
+                worker_->wrote(table_name);
+            return true;
+        } catch (const std::exception& e)
+        {
+            std::cerr << "\nError : " << e.what() << "was raised while committing a pipeline\n";
+            return false;
+        }
+    }
+
+private:
+    pqxx::pipeline& pipeline()
+    {
+        if (!pipeline_)
+            throw pqxx::usage_error("Pipeline used after commit()");
+        return *pipeline_;
+    }
+
+    /// Explores an unknown table through the pipeline, holding the only connection it may use.
+    void explore(const std::string& table_name)
+    {
+        worker_->table_schema(table_name, [this](const std::string& query) {
+            pqxx::pipeline& p = pipeline();
+            return p.retrieve(p.insert(query));
+        });
+    }
+
+    /// Notes a table written to, whose cached results are dropped once the writes are committed.
+    void wrote(const std::string& table_name)
+    {
+        if (std::find(written_.begin(), written_.end(), table_name) == written_.end())
+            written_.push_back(table_name);
+    }
+
+    DatabaseWorker* worker_;
+    // Declaration order matters: the pipeline is destroyed before its transaction, then the connection is released
+    ConnectionPool::Lease connection_;
+    std::unique_ptr<pqxx::work> work_;
+    std::unique_ptr<pqxx::pipeline> pipeline_;
+    std::vector<std::string> written_;
+};
+
+inline Pipeline DatabaseWorker::pipeline()
+{
+    return Pipeline(*this, pool_->acquire());
+}
+
+}  // namespace pgi
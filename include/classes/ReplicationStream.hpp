@@ -0,0 +1,570 @@
+#pragma once
+#include <libpq-fe.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "utl/decode_utls.hpp"
+#include "classes/TableSchema.hpp"
+
+namespace pgi {
+
+struct ReplicationOptions
+{
+    /// Logical replication slot to consume, created with the pgoutput plugin if it does not exist.
+    std::string slot = "pgi_slot";
+    /// Publications whose tables are streamed, comma separated (see CREATE PUBLICATION).
+    std::string publication = "pgi_publication";
+    /// Creates the slot if it does not exist.
+    bool create_slot = true;
+    /// First LSN to stream, "0/0" to resume from the last position confirmed on the slot.
+    std::string start_lsn = "0/0";
+    /// A batch is handed out once it holds batch_rows changes, once batch_interval elapsed since its first change,
+    /// or as soon as no more data is waiting, always at a transaction boundary unless the transaction alone
+    /// exceeds batch_rows.
+    std::size_t batch_rows = 10000;
+    std::chrono::milliseconds batch_interval{100};
+    /// Maximum time between two standby status updates reporting the handed out position to the server.
+    std::chrono::milliseconds feedback_interval{10000};
+};
+
+enum class ChangeKind
+{
+    insert,
+    update,
+    remove,
+    truncate
+};
+
+/// Table as described by the pgoutput Relation message of the stream.
+struct ReplicatedRelation
+{
+    std::uint32_t oid = 0;
+    /// "schema.table"
+    std::string table;
+    std::vector<std::string> column_names;
+    std::vector<pqxx::oid> column_types;
+    /// Explored schema of the table, null if it is unknown.
+    const TableSchema* schema = nullptr;
+
+    int column_index(const std::string& column_name) const
+    {
+        for (std::size_t i = 0; i < column_names.size(); i++)
+            if (column_names[i] == column_name)
+                return int(i);
+        return -1;
+    }
+};
+
+/// Values of a replicated row in text format, viewing the received message without any copy.
+/// Null values have a null data(), like unchanged TOAST values which is_unchanged() tells apart.
+struct ReplicatedTuple
+{
+    std::vector<std::string_view> values;
+    /// Per value: 'n' null, 'u' unchanged TOAST value, 't' text.
+    std::vector<char> kinds;
+
+    std::size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+    bool is_null(std::size_t i) const { return kinds[i] == 'n'; }
+    bool is_unchanged(std::size_t i) const { return kinds[i] == 'u'; }
+};
+
+/// One row change of a committed transaction.
+struct RowChange
+{
+    ChangeKind kind;
+    const ReplicatedRelation* relation;
+    /// New row of an insert or update, key (or old row with REPLICA IDENTITY FULL) of a delete.
+    ReplicatedTuple row;
+    /// Key or old row of an update when the server sent it, empty otherwise.
+    ReplicatedTuple old_row;
+
+    /// Decodes a value of row, see utl::decode_value.
+    template <typename T>
+    T get(std::size_t col) const
+    {
+        T val;
+        utl::decode_value(col < row.size() ? row.values[col] : std::string_view(), val);
+        return val;
+    }
+
+    template <typename T>
+    T get(const std::string& column_name) const
+    {
+        int col = relation->column_index(column_name);
+        return get<T>(col < 0 ? row.size() : std::size_t(col));
+    }
+};
+
+/// Changes handed out at once. Views on the received messages, valid until the callback returns.
+struct ChangeBatch
+{
+    std::vector<RowChange> changes;
+    /// End LSN of the last committed transaction of the batch, confirmed to the server once the callback returned.
+    std::uint64_t lsn = 0;
+    /// Commit time of the last committed transaction of the batch.
+    time_point_t commit_time;
+    /// True if the batch ends in the middle of a transaction larger than batch_rows, continued by the next one.
+    bool partial = false;
+};
+
+/// Consumer of a logical replication slot through the pgoutput protocol (version 1), on its own replication
+/// connection. Row changes of the tables of the publication are decoded straight from the received messages and
+/// handed out in batches; the position of every batch the callback returned from is reported to the server, which
+/// may then recycle the WAL before it. On restart, streaming resumes after the last reported position, so a batch
+/// whose callback did not return may be handed out again.
+/// Obtained from DatabaseWorker::replication_stream(). run() blocks the calling thread until stop() is called.
+class ReplicationStream
+{
+public:
+    using callback_t = std::function<void(const ChangeBatch&)>;
+    /// Gives the explored schema of a table, or null.
+    using resolver_t = std::function<const TableSchema*(const std::string& table)>;
+
+    ReplicationStream(const std::string& connection_string, ReplicationOptions options, resolver_t resolver = nullptr)
+        : connection_string_(connection_string + " replication=database"),
+          options_(std::move(options)),
+          resolver_(std::move(resolver))
+    {
+        if (pipe(wake_pipe_) != 0)
+            throw std::runtime_error("ReplicationStream: cannot create its wake-up pipe");
+        fcntl(wake_pipe_[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake_pipe_[1], F_SETFL, O_NONBLOCK);
+        options_.batch_rows = std::max<std::size_t>(options_.batch_rows, 1);
+    }
+
+    ReplicationStream(const ReplicationStream&) = delete;
+    ReplicationStream& operator=(const ReplicationStream&) = delete;
+
+    ~ReplicationStream()
+    {
+        if (connection_)
+            PQfinish(connection_);
+        ::close(wake_pipe_[0]);
+        ::close(wake_pipe_[1]);
+    }
+
+    /// Streams the changes to callback until stop() is called. Returns false, after reporting the error on
+    /// std::cerr, if the connection failed or was lost; run() may then be called again to resume.
+    bool run(const callback_t& callback)
+    {
+        stop_ = false;
+        bool ok = start() && stream(callback);
+        if (connection_)
+        {
+            if (ok)
+                send_feedback();
+            PQfinish(connection_);
+            connection_ = nullptr;
+        }
+        return ok;
+    }
+
+    /// Makes run() return once the batch being handed out, if any, was processed. Callable from any thread.
+    void stop()
+    {
+        stop_ = true;
+        if (write(wake_pipe_[1], "", 1) < 0)
+        {
+            // The pipe is full: run() is already due to wake up
+        }
+    }
+
+    /// Last position reported to the server as processed.
+    std::uint64_t confirmed_lsn() const { return confirmed_lsn_.load(); }
+
+    /// Number of row changes handed out.
+    std::uint64_t changes() const { return changes_.load(); }
+
+    static std::string format_lsn(std::uint64_t lsn)
+    {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%X/%X", unsigned(lsn >> 32), unsigned(lsn & 0xFFFFFFFF));
+        return text;
+    }
+
+    static std::uint64_t parse_lsn(const std::string& text)
+    {
+        unsigned high = 0;
+        unsigned low = 0;
+        if (std::sscanf(text.c_str(), "%X/%X", &high, &low) != 2)
+            return 0;
+        return (std::uint64_t(high) << 32) | low;
+    }
+
+private:
+    /// Received message, freed once no change views it anymore.
+    using buffer_t = std::unique_ptr<char, void (*)(void*)>;
+
+    /// Microseconds between the Unix and the postgres (2000-01-01) epochs.
+    static constexpr std::int64_t postgres_epoch_us = 946684800LL * 1000000;
+
+    bool fail(const std::string& when)
+    {
+        std::cerr << "\nError : " << PQerrorMessage(connection_) << "was raised while " << when << '\n';
+        return false;
+    }
+
+    /// Connects, creates the slot if needed and starts streaming in COPY BOTH mode.
+    bool start()
+    {
+        connection_ = PQconnectdb(connection_string_.c_str());
+        if (PQstatus(connection_) != CONNECTION_OK)
+            return fail("opening the replication connection");
+
+        char* slot = PQescapeIdentifier(connection_, options_.slot.c_str(), options_.slot.size());
+        char* publication = PQescapeLiteral(connection_, options_.publication.c_str(), options_.publication.size());
+        if (!slot || !publication)
+        {
+            PQfreemem(slot);
+            PQfreemem(publication);
+            return fail("quoting the slot and publication names");
+        }
+        std::string slot_name = slot;
+        std::string publication_names = publication;
+        PQfreemem(slot);
+        PQfreemem(publication);
+
+        if (options_.create_slot)
+        {
+            std::string statement = "CREATE_REPLICATION_SLOT " + slot_name + " LOGICAL pgoutput";
+            PGresult* res = PQexec(connection_, statement.c_str());
+            const char* state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+            // 42710 : the slot already exists
+            bool ok = PQresultStatus(res) == PGRES_TUPLES_OK || (state && std::string_view(state) == "42710");
+            PQclear(res);
+            if (!ok)
+                return fail("creating replication slot " + options_.slot);
+        }
+
+        std::string statement = "START_REPLICATION SLOT " + slot_name + " LOGICAL " +
+                                format_lsn(parse_lsn(options_.start_lsn)) +
+                                " (proto_version '1', publication_names " + publication_names + ")";
+        PGresult* res = PQexec(connection_, statement.c_str());
+        bool ok = PQresultStatus(res) == PGRES_COPY_BOTH;
+        PQclear(res);
+        if (!ok)
+            return fail("starting replication from slot " + options_.slot);
+        PQsetnonblocking(connection_, 1);
+        // Changes not handed out before a failure are streamed again from the reported position
+        batch_ = ChangeBatch();
+        buffers_.clear();
+        retired_.clear();
+        in_transaction_ = false;
+        last_feedback_ = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    bool stream(const callback_t& callback)
+    {
+        for (;;)
+        {
+            if (stop_)
+                return true;
+            char* data = nullptr;
+            int length = PQgetCopyData(connection_, &data, 1);
+            if (length > 0)
+            {
+                buffer_t buffer(data, PQfreemem);
+                if (!receive(std::move(buffer), std::size_t(length), callback))
+                    return false;
+                continue;
+            }
+            if (length == -1)
+            {
+                std::cerr << "\nError : the server ended the replication stream of slot " << options_.slot << '\n';
+                return false;
+            }
+            if (length == -2)
+                return fail("reading the replication stream");
+
+            // Nothing waiting: hand out what is committed, then wait for the socket or the next deadline
+            if (!batch_.changes.empty() && !in_transaction_)
+                deliver(callback);
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_feedback_ >= options_.feedback_interval && !send_feedback())
+                return false;
+            auto timeout = options_.feedback_interval - (now - last_feedback_);
+            if (!batch_.changes.empty())
+                timeout = std::min<std::chrono::steady_clock::duration>(timeout, options_.batch_interval);
+            pollfd fds[2] = {{wake_pipe_[0], POLLIN, 0}, {PQsocket(connection_), POLLIN, 0}};
+            int ms = int(std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count()) + 1;
+            if (poll(fds, 2, std::max(ms, 1)) < 0)
+                continue;
+            if (fds[0].revents & POLLIN)
+            {
+                char buffer[64];
+                while (read(wake_pipe_[0], buffer, sizeof(buffer)) > 0)
+                {
+                }
+            }
+            if (!PQconsumeInput(connection_))
+                return fail("reading the replication stream");
+        }
+    }
+
+    /// Handles one CopyData message: XLogData ('w') carrying a pgoutput message, or a primary keepalive ('k').
+    bool receive(buffer_t buffer, std::size_t length, const callback_t& callback)
+    {
+        const char* p = buffer.get();
+        const char* end = p + length;
+        if (*p == 'k' && length >= 18)
+        {
+            std::uint64_t wal_end = read_u64(p + 1);
+            received_lsn_ = std::max(received_lsn_, wal_end);
+            // Nothing is held back between transactions: everything up to wal_end was handed out
+            if (!in_transaction_ && batch_.changes.empty())
+                processed_lsn_ = std::max(processed_lsn_, wal_end);
+            return p[17] ? send_feedback() : true;
+        }
+        if (*p != 'w' || length < 26)
+            return true;
+        received_lsn_ = std::max(received_lsn_, read_u64(p + 9));
+        p += 25;
+
+        bool viewed = false;
+        switch (*p++)
+        {
+            case 'B':
+                in_transaction_ = true;
+                break;
+            case 'C':
+            {
+                // flags, commit LSN, end LSN, commit time
+                in_transaction_ = false;
+                batch_.lsn = read_u64(p + 9);
+                batch_.commit_time = time_point_t(std::chrono::microseconds(read_i64(p + 17) + postgres_epoch_us));
+                auto age = std::chrono::steady_clock::now() - batch_start_;
+                if (batch_.changes.size() >= options_.batch_rows ||
+                    (!batch_.changes.empty() && age >= options_.batch_interval))
+                    deliver(callback);
+                else if (batch_.changes.empty())
+                    processed_lsn_ = std::max(processed_lsn_, batch_.lsn);
+                break;
+            }
+            case 'R':
+                relation(p, end);
+                break;
+            case 'I':
+            case 'U':
+            case 'D':
+                viewed = row_change(p[-1], p, end);
+                break;
+            case 'T':
+                truncate(p);
+                break;
+            default:
+                // Type, origin and logical decoding messages are not handed out
+                break;
+        }
+        if (viewed)
+            buffers_.push_back(std::move(buffer));
+        if (batch_.changes.size() >= options_.batch_rows && in_transaction_)
+        {
+            batch_.partial = true;
+            deliver(callback);
+        }
+        return true;
+    }
+
+    void relation(const char* p, const char* end)
+    {
+        std::unique_ptr<ReplicatedRelation> r(new ReplicatedRelation());
+        r->oid = read_u32(p);
+        p += 4;
+        std::string schema = read_string(p, end);
+        r->table = schema + "." + read_string(p, end);
+        p += 1;  // replica identity setting
+        std::uint16_t columns = read_u16(p);
+        p += 2;
+        for (std::uint16_t i = 0; i < columns && p < end; i++)
+        {
+            p += 1;  // flags
+            r->column_names.push_back(read_string(p, end));
+            r->column_types.push_back(pqxx::oid(read_u32(p)));
+            p += 8;  // type oid and modifier
+        }
+        if (resolver_)
+            r->schema = resolver_(r->table);
+        std::unique_ptr<ReplicatedRelation>& slot = relations_[r->oid];
+        // Changes of the batch may still point to the previous definition
+        if (slot)
+            retired_.push_back(std::move(slot));
+        slot = std::move(r);
+    }
+
+    /// Appends an insert, update or delete. Returns true if it views the message.
+    bool row_change(char type, const char* p, const char* end)
+    {
+        auto it = relations_.find(read_u32(p));
+        if (it == relations_.end())
+            return false;
+        p += 4;
+        RowChange change{type == 'I' ? ChangeKind::insert : type == 'U' ? ChangeKind::update : ChangeKind::remove,
+            it->second.get(),
+            {},
+            {}};
+        if (type == 'U' && (*p == 'K' || *p == 'O'))
+        {
+            p++;
+            read_tuple(p, end, change.old_row);
+        }
+        p++;  // 'N' new tuple, or 'K' / 'O' key or old tuple of a delete
+        read_tuple(p, end, change.row);
+        add(std::move(change));
+        return true;
+    }
+
+    void truncate(const char* p)
+    {
+        std::uint32_t relations = read_u32(p);
+        p += 5;  // count and options
+        for (std::uint32_t i = 0; i < relations; i++, p += 4)
+        {
+            auto it = relations_.find(read_u32(p));
+            if (it != relations_.end())
+                add(RowChange{ChangeKind::truncate, it->second.get(), {}, {}});
+        }
+    }
+
+    void add(RowChange&& change)
+    {
+        if (batch_.changes.empty())
+            batch_start_ = std::chrono::steady_clock::now();
+        batch_.changes.push_back(std::move(change));
+    }
+
+    static void read_tuple(const char*& p, const char* end, ReplicatedTuple& tuple)
+    {
+        std::uint16_t columns = read_u16(p);
+        p += 2;
+        tuple.values.reserve(columns);
+        tuple.kinds.reserve(columns);
+        for (std::uint16_t i = 0; i < columns && p < end; i++)
+        {
+            char kind = *p++;
+            if (kind == 't' || kind == 'b')
+            {
+                std::uint32_t length = read_u32(p);
+                p += 4;
+                tuple.values.emplace_back(p, length);
+                tuple.kinds.push_back('t');
+                p += length;
+            }
+            else
+            {
+                tuple.values.emplace_back();
+                tuple.kinds.push_back(kind);
+            }
+        }
+    }
+
+    /// Hands out the batch then reports its position, releasing the messages it viewed.
+    void deliver(const callback_t& callback)
+    {
+        try
+        {
+            callback(batch_);
+        } catch (const std::exception& e)
+        {
+            std::cerr << "\nError : " << e.what() << "was raised while handling " << batch_.changes.size()
+                      << " replicated changes\n";
+        }
+        changes_ += batch_.changes.size();
+        // lsn is the end of the last transaction committed in the batch, so a partial batch does not confirm the
+        // transaction it ends in
+        processed_lsn_ = std::max(processed_lsn_, batch_.lsn);
+        batch_.changes.clear();
+        batch_.partial = false;
+        buffers_.clear();
+        retired_.clear();
+    }
+
+    /// Sends a standby status update reporting the received and processed positions.
+    bool send_feedback()
+    {
+        char message[34];
+        message[0] = 'r';
+        write_u64(message + 1, received_lsn_);
+        write_u64(message + 9, processed_lsn_);
+        write_u64(message + 17, processed_lsn_);
+        std::int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::system_clock::now().time_since_epoch())
+                               .count() -
+                           postgres_epoch_us;
+        write_u64(message + 25, std::uint64_t(now));
+        message[33] = 0;
+        int sent = PQputCopyData(connection_, message, sizeof(message));
+        if (sent < 0 || PQflush(connection_) < 0)
+            return fail("sending replication feedback");
+        if (sent == 0)
+            return true;  // The send buffer is full, retried on the next deadline
+        confirmed_lsn_ = processed_lsn_;
+        last_feedback_ = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    static std::uint16_t read_u16(const char* p)
+    {
+        auto b = reinterpret_cast<const unsigned char*>(p);
+        return std::uint16_t((b[0] << 8) | b[1]);
+    }
+    static std::uint32_t read_u32(const char* p)
+    {
+        auto b = reinterpret_cast<const unsigned char*>(p);
+        return (std::uint32_t(b[0]) << 24) | (std::uint32_t(b[1]) << 16) | (std::uint32_t(b[2]) << 8) | b[3];
+    }
+    static std::uint64_t read_u64(const char* p) { return (std::uint64_t(read_u32(p)) << 32) | read_u32(p + 4); }
+    static std::int64_t read_i64(const char* p) { return std::int64_t(read_u64(p)); }
+    static void write_u64(char* p, std::uint64_t v)
+    {
+        for (int i = 7; i >= 0; i--, v >>= 8)
+            p[i] = char(v & 0xFF);
+    }
+    /// Reads a null terminated string and moves past it.
+    static std::string read_string(const char*& p, const char* end)
+    {
+        const char* start = p;
+        while (p < end && *p)
+            p++;
+        std::string s(start, p);
+        if (p < end)
+            p++;
+        return s;
+    }
+
+    std::string connection_string_;
+    ReplicationOptions options_;
+    resolver_t resolver_;
+    PGconn* connection_ = nullptr;
+    int wake_pipe_[2] = {-1, -1};
+    std::atomic<bool> stop_{false};
+
+    std::unordered_map<std::uint32_t, std::unique_ptr<ReplicatedRelation>> relations_;
+    std::vector<std::unique_ptr<ReplicatedRelation>> retired_;
+    ChangeBatch batch_;
+    std::vector<buffer_t> buffers_;
+    std::chrono::steady_clock::time_point batch_start_;
+    bool in_transaction_ = false;
+
+    std::uint64_t received_lsn_ = 0;
+    std::uint64_t processed_lsn_ = 0;
+    std::atomic<std::uint64_t> confirmed_lsn_{0};
+    std::atomic<std::uint64_t> changes_{0};
+    std::chrono::steady_clock::time_point last_feedback_;
+};
+
+}  // namespace pgi
@@ -0,0 +1,178 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pgi {
+
+struct ResultCacheOptions
+{
+    /// Time to live of the results of the tables not listed in table_ttl, 0 to cache only the listed ones.
+    std::chrono::milliseconds default_ttl{0};
+    /// Time to live of the results per table, 0 to never cache a table.
+    std::unordered_map<std::string, std::chrono::milliseconds> table_ttl;
+    /// Maximum number of cached results. When full, expired results are evicted and, if none was, the new result
+    /// is not cached.
+    std::size_t max_entries = 1024;
+};
+
+/// Results of select statements keyed by their SQL text, kept for the time to live of their table and dropped as
+/// soon as the owning DatabaseWorker writes to that table. A hit hands out a copy of the cached pqxx::result, which
+/// shares its immutable rows, without any round trip. A fetched result is only stored if no write to its table
+/// completed since its generation was read, so a result fetched before a write is never cached after it.
+class ResultCache
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit ResultCache(ResultCacheOptions options) : options_(std::move(options)) {}
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    /// Time to live of the results of a table, 0 if they are not cached.
+    std::chrono::milliseconds ttl(const std::string& table) const
+    {
+        auto it = options_.table_ttl.find(table);
+        return it == options_.table_ttl.end() ? options_.default_ttl : it->second;
+    }
+
+    /// Copies the cached result of a statement into r. Returns false if there is none or it expired.
+    bool get(const std::string& statement, pqxx::result& r)
+    {
+        {
+            std::shared_lock<std::shared_mutex> guard(mutex_);
+            auto it = entries_.find(statement);
+            if (it != entries_.end() && it->second.expires > clock::now())
+            {
+                r = it->second.result;
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /// Number of completed writes to a table, read before fetching a result to put.
+    std::uint64_t generation(const std::string& table) const
+    {
+        std::shared_lock<std::shared_mutex> guard(mutex_);
+        auto it = tables_.find(table);
+        return it == tables_.end() ? 0 : it->second.generation;
+    }
+
+    /// Caches the result of a statement on table, fetched after generation(table) returned generation.
+    void put(const std::string& table, const std::string& statement, std::uint64_t generation, const pqxx::result& r)
+    {
+        std::chrono::milliseconds table_ttl = ttl(table);
+        if (table_ttl.count() <= 0)
+            return;
+        clock::time_point now = clock::now();
+        std::unique_lock<std::shared_mutex> guard(mutex_);
+        TableEntries& entries = tables_[table];
+        if (entries.generation != generation)
+            return;
+        auto it = entries_.find(statement);
+        if (it == entries_.end())
+        {
+            if (entries_.size() >= options_.max_entries && evict_expired(now) == 0)
+                return;
+            it = entries_.emplace(statement, Entry{r, now + table_ttl}).first;
+            entries.statements.push_back(statement);
+        }
+        else
+        {
+            it->second.result = r;
+            it->second.expires = now + table_ttl;
+        }
+    }
+
+    /// Drops the cached results of a table once it was written to.
+    void invalidate(const std::string& table)
+    {
+        if (ttl(table).count() <= 0)
+            return;
+        std::unique_lock<std::shared_mutex> guard(mutex_);
+        TableEntries& entries = tables_[table];
+        entries.generation++;
+        for (const std::string& statement : entries.statements)
+            entries_.erase(statement);
+        entries.statements.clear();
+    }
+
+    /// Drops every cached result.
+    void clear()
+    {
+        std::unique_lock<std::shared_mutex> guard(mutex_);
+        for (auto& [table, entries] : tables_)
+        {
+            entries.generation++;
+            entries.statements.clear();
+        }
+        entries_.clear();
+    }
+
+    std::size_t size() const
+    {
+        std::shared_lock<std::shared_mutex> guard(mutex_);
+        return entries_.size();
+    }
+    std::uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    std::uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry
+    {
+        pqxx::result result;
+        clock::time_point expires;
+    };
+
+    /// Write generation and cached statements of one table.
+    struct TableEntries
+    {
+        std::uint64_t generation = 0;
+        std::vector<std::string> statements;
+    };
+
+    /// Drops the expired results, the caller holding the unique lock. Returns how many were dropped.
+    std::size_t evict_expired(clock::time_point now)
+    {
+        std::size_t evicted = 0;
+        for (auto& [table, entries] : tables_)
+        {
+            auto& statements = entries.statements;
+            for (std::size_t i = 0; i < statements.size();)
+            {
+                auto it = entries_.find(statements[i]);
+                if (it != entries_.end() && it->second.expires > now)
+                {
+                    i++;
+                    continue;
+                }
+                if (it != entries_.end())
+                {
+                    entries_.erase(it);
+                    evicted++;
+                }
+                statements[i] = std::move(statements.back());
+                statements.pop_back();
+            }
+        }
+        return evicted;
+    }
+
+    ResultCacheOptions options_;
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::unordered_map<std::string, TableEntries> tables_;
+    std::atomic<std::uint64_t> hits_{0};
+    std::atomic<std::uint64_t> misses_{0};
+};
+
+}  // namespace pgi
@@ -0,0 +1,148 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "classes/TableSchema.hpp"
+
+namespace pgi {
+
+/// Explored table schemas by name, read without any lock.
+/// Schemas live in an insert-only open addressing table of atomic pointers: lookups probe the current table with
+/// acquire loads, writers insert under a mutex with release stores, and growing publishes a copy twice as large.
+/// Entries are never removed and previous tables are kept until destruction, so a reader never sees freed memory
+/// and returned references stay valid for the lifetime of the registry. Unknown tables are explored once: concurrent
+/// callers of find_or_explore for the same table wait for the first one, callers for other tables do not.
+class SchemaRegistry
+{
+public:
+    SchemaRegistry() { grow(16); }
+
+    SchemaRegistry(const SchemaRegistry&) = delete;
+    SchemaRegistry& operator=(const SchemaRegistry&) = delete;
+
+    /// Schema of a table, null if it was not explored.
+    const TableSchema* find(const std::string& table_name) const
+    {
+        const Table* table = table_.load(std::memory_order_acquire);
+        for (std::size_t i = std::hash<std::string>()(table_name) & table->mask;; i = (i + 1) & table->mask)
+        {
+            const Entry* entry = table->slots[i].load(std::memory_order_acquire);
+            if (!entry)
+                return nullptr;
+            if (entry->name == table_name)
+                return &entry->schema;
+        }
+    }
+
+    /// Adds explored schemas, keeping the existing entry of a table explored twice.
+    void publish(std::unordered_map<std::string, TableSchema>&& schemas)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (auto& [table_name, schema] : schemas)
+        {
+            if (find(table_name))
+                continue;
+            entries_.push_back(Entry{table_name, std::move(schema)});
+            Table& table = *tables_.back();
+            if (2 * entries_.size() > table.mask + 1)
+                grow(2 * (table.mask + 1));
+            else
+                insert(table, &entries_.back());
+        }
+    }
+
+    /// Schema of a table, calling explore() to publish it if it is unknown. Returns null if it is still unknown
+    /// afterwards, the next caller exploring it again.
+    const TableSchema* find_or_explore(const std::string& table_name, const std::function<void()>& explore)
+    {
+        if (const TableSchema* schema = find(table_name))
+            return schema;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            explored_.wait(lock, [&] { return !exploring_.count(table_name); });
+            if (const TableSchema* schema = find(table_name))
+                return schema;
+            exploring_.insert(table_name);
+        }
+        // Explored without the lock: lookups and the exploration of other tables go on meanwhile
+        struct Done
+        {
+            SchemaRegistry* registry;
+            const std::string& table_name;
+            ~Done()
+            {
+                {
+                    std::lock_guard<std::mutex> guard(registry->mutex_);
+                    registry->exploring_.erase(table_name);
+                }
+                registry->explored_.notify_all();
+            }
+        } done{this, table_name};
+        explore();
+        return find(table_name);
+    }
+
+    /// Calls f(table_name, schema) for every schema.
+    template <typename F>
+    void for_each(F&& f) const
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (const Entry& entry : entries_)
+            f(entry.name, entry.schema);
+    }
+
+private:
+    struct Entry
+    {
+        std::string name;
+        TableSchema schema;
+    };
+
+    struct Table
+    {
+        explicit Table(std::size_t capacity) : slots(new std::atomic<const Entry*>[capacity]), mask(capacity - 1)
+        {
+            for (std::size_t i = 0; i < capacity; i++)
+                slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+        std::unique_ptr<std::atomic<const Entry*>[]> slots;
+        std::size_t mask;
+    };
+
+    static void insert(Table& table, const Entry* entry)
+    {
+        std::size_t i = std::hash<std::string>()(entry->name) & table.mask;
+        while (table.slots[i].load(std::memory_order_relaxed))
+            i = (i + 1) & table.mask;
+        table.slots[i].store(entry, std::memory_order_release);
+    }
+
+    /// Publishes a table of capacity slots (a power of two) holding every entry, the mutex being held.
+    void grow(std::size_t capacity)
+    {
+        std::unique_ptr<Table> table(new Table(capacity));
+        for (const Entry& entry : entries_)
+            insert(*table, &entry);
+        table_.store(table.get(), std::memory_order_release);
+        tables_.push_back(std::move(table));
+    }
+
+    std::atomic<const Table*> table_{nullptr};
+    /// Every table published, the current one last, freed with the registry.
+    std::vector<std::unique_ptr<Table>> tables_;
+    /// Stable storage of the entries.
+    std::deque<Entry> entries_;
+    /// Tables being explored by find_or_explore.
+    std::unordered_set<std::string> exploring_;
+    mutable std::mutex mutex_;
+    std::condition_variable explored_;
+};
+
+}  // namespace pgi
@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace pgi {
+
+/// In-memory description of an explored table, used on the hot paths instead of the YAML configuration.
+struct TableSchema
+{
+    std::string schema;
+    std::string table;
+    /// Columns in table order.
+    std::vector<std::string> column_names;
+    std::vector<pqxx::oid> column_types;
+    std::vector<std::string> column_typnames;
+    /// Index of the primary key in column_names, -1 if the table has none.
+    int primary_key = -1;
+    /// "INSERT INTO table(...) VALUES(" listing every column but the primary key (kept if it is a timestamp).
+    std::string insert_prefix;
+    /// Types of the columns listed in insert_prefix, in order.
+    std::vector<pqxx::oid> insert_types;
+
+    /// Index of a column in column_names, -1 if the table has no such column.
+    int column_index(const std::string& column_name) const
+    {
+        for (size_t i = 0; i < column_names.size(); i++)
+            if (column_names[i] == column_name)
+                return int(i);
+        return -1;
+    }
+
+    const std::string& primary_key_name() const
+    {
+        static const std::string none = "_none_";
+        return primary_key < 0 ? none : column_names[primary_key];
+    }
+
+    /// Precomputes insert_prefix once columns and primary key are known.
+    void compile(const std::string& table_name)
+    {
+        insert_prefix = "INSERT INTO " + table_name + "(";
+        insert_types.clear();
+        bool first = true;
+        for (size_t i = 0; i < column_names.size(); i++)
+        {
+            // Include column only if it is not a primary key except if it is of type timestamp
+            if (int(i) == primary_key && column_typnames[i].find("timestamp") == std::string::npos)
+                continue;
+            if (!first)
+                insert_prefix += ", ";
+            insert_prefix += '"';
+            insert_prefix += column_names[i];
+            insert_prefix += '"';
+            insert_types.push_back(column_types[i]);
+            first = false;
+        }
+        insert_prefix += ") VALUES(";
+    }
+};
+
+}  // namespace pgi
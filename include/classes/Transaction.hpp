@@ -0,0 +1,286 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "classes/DatabaseWorker.hpp"
+
+namespace pgi {
+
+/// Transaction spanning several statements on one pooled connection, committed once by commit().
+/// Offers the statement methods of DatabaseWorker, built the same way. Once a statement failed every following
+/// one is skipped and commit() rolls back. Destroying an uncommitted transaction rolls it back.
+/// Obtained from DatabaseWorker::begin(). Unknown tables are explored on the connection of the transaction.
+class Transaction
+{
+public:
+    Transaction(DatabaseWorker& worker, ConnectionPool::Lease&& connection)
+        : worker_(&worker), connection_(std::move(connection)), work_(new pqxx::work(*connection_))
+    {
+    }
+
+    Transaction(Transaction&&) = default;
+
+    pqxx::result execute(const std::string& statement)
+    {
+        pqxx::result r;
+        run(statement, [&] { r = work_->exec(statement); });
+        return r;
+    }
+
+    pqxx::result select(const std::string& table_name,
+        const std::vector<std::string> fields = std::vector<std::string>(),
+        const std::string& condition = "",
+        const std::string& order_by = "",
+        const int& limit = 10000)
+    {
+        if (!explore(table_name))
+            return pqxx::result();
+        utl::SqlBuffer::Lease buf;
+        worker_->select_statement(*buf, table_name, fields, condition, order_by);
+        buf->append(" LIMIT ").append_number(limit);
+        return execute(buf->str());
+    }
+
+    template <typename... Args>
+    void insert(const std::string& table_name, const Args&... values)
+    {
+        if (!explore(table_name))
+            return;
+        wrote(table_name);
+        if constexpr ((std::is_arithmetic<Args>::value && ...))
+        {
+            execute_prepared(worker_->prepared_insert(table_name, sizeof...(values)), pqxx::params(values...));
+        }
+        else
+        {
+            utl::SqlBuffer::Lease buf;
+            worker_->insert_statement(*buf, table_name, values...);
+            execute(buf->str());
+        }
+    }
+
+    template <typename T>
+    void insert(const std::string& table_name, const std::vector<T>& vector)
+    {
+        if constexpr (utl::row_traits<T>::is_row)
+            insert_rows(table_name, vector);
+        else
+        {
+            if (!explore(table_name))
+                return;
+            wrote(table_name);
+            if constexpr (std::is_arithmetic<T>::value)
+            {
+                const PreparedStatement& statement = worker_->prepared_insert(table_name, vector.size());
+                execute_prepared(statement, DatabaseWorker::vector_params(statement, vector));
+            }
+            else
+            {
+                utl::SqlBuffer::Lease buf;
+                worker_->vector_insert_statement(*buf, table_name, vector);
+                execute(buf->str());
+            }
+        }
+    }
+
+    template <typename T>
+    void insert(const std::string& table_name, time_point_t tp, const std::vector<T>& vector)
+    {
+        if (!explore(table_name))
+            return;
+        wrote(table_name);
+        if constexpr (std::is_arithmetic<T>::value)
+        {
+            const PreparedStatement& statement = worker_->prepared_insert(table_name, vector.size() + 1);
+            execute_prepared(statement, DatabaseWorker::vector_params(statement, vector, &tp));
+        }
+        else
+        {
+            utl::SqlBuffer::Lease buf;
+            worker_->vector_insert_statement(*buf, table_name, vector, &tp);
+            execute(buf->str());
+        }
+    }
+
+    template <typename T>
+    void insert_rows(const std::string& table_name, const std::vector<T>& rows)
+    {
+        if (!explore(table_name))
+            return;
+        wrote(table_name);
+        static_assert(utl::row_traits<T>::is_row, "Row type must be declared with PGI_ROW");
+        const PreparedStatement& statement = worker_->prepared_row_insert<T>(table_name);
+        run(statement.definition, [&] {
+            connection_.prepare(statement);
+            DatabaseWorker::exec_rows(*work_, statement, rows);
+        });
+    }
+
+    template <typename... Args>
+    void insert_from_maps(const std::string& table_name, const Args&... maps)
+    {
+        if (!explore(table_name))
+            return;
+        wrote(table_name);
+        utl::SqlBuffer::Lease buf;
+        worker_->insert_from_maps_statement(*buf, table_name, maps...);
+        execute(buf->str());
+    }
+
+    template <typename... Args>
+    void bulk_insert_from_maps(const std::string& table_name, const Args&... maps)
+    {
+        if (!explore(table_name))
+            return;
+        wrote(table_name);
+        utl::SqlBuffer::Lease buf;
+        worker_->bulk_insert_statement(*buf, table_name, maps...);
+        execute(buf->str());
+    }
+
+    template <typename... Args>
+    void bulk_copy_from_maps(const std::string& table_name, const Args&... maps)
+    {
+        if (!explore(table_name))
+            return;
+        wrote(table_name);
+        run("COPY " + table_name + " FROM STDIN", [&] { worker_->copy_statement(*work_, table_name, maps...); });
+    }
+
+    template <typename... Args>
+    void update_from_maps(const std::string& table_name, const std::string& condition, const Args&... maps)
+    {
+        if (!explore(table_name))
+            return;
+        wrote(table_name);
+        utl::SqlBuffer::Lease buf;
+        worker_->update_statement(*buf, table_name, condition, maps...);
+        execute(buf->str());
+    }
+
+    /// Single UPDATE ... FROM (VALUES ...) of DatabaseWorker::bulk_update_from_maps, whatever the number of rows.
+    template <typename... Args>
+    void bulk_update_from_maps(const std::string& table_name, const std::string& key_column, const Args&... maps)
+    {
+        if (!explore(table_name))
+            return;
+        wrote(table_name);
+        utl::SqlBuffer::Lease buf;
+        worker_->bulk_update_statement(*buf, table_name,
+            key_column.empty() ? worker_->known_schema(table_name).primary_key_name() : key_column, maps...);
+        execute(buf->str());
+    }
+
+    void clear(const std::string& table_name)
+    {
+        wrote(table_name);
+        execute("TRUNCATE " + table_name + " CASCADE");
+    }
+
+    /// Returns true until a statement of the transaction failed.
+    bool ok() const { return !failed_; }
+
+    /// Commits every statement. Returns false, after rolling back, if one of them or the commit failed.
+    bool commit()
+    {
+        if (failed_)
+        {
+            abort();
+            return false;
+        }
+        try
+        {
+            work_->commit();
+            for (const std::string& table_name : written_)
+                worker_->wrote(table_name);
+            return true;
+        } catch (const std::exception& e)
+        {
+            failed_ = true;
+            std::cerr << "\nError : " << e.what() << "was raised while committing a transaction\n";
+            return false;
+        }
+    }
+
+    void abort()
+    {
+        try
+        {
+            work_->abort();
+        } catch (const std::exception& e)
+        {
+            std::cerr << "\nError : " << e.what() << "was raised while rolling back a transaction\n";
+        }
+    }
+
+private:
+    /// Explores an unknown table on the connection of the transaction, in a subtransaction so that a failure of the
+    /// exploration leaves the transaction usable. Returns false, skipping the statement, once a statement failed or
+    /// if the table could not be explored: the builders and prepared statements of the worker would explore it on
+    /// another pooled connection.
+    bool explore(const std::string& table_name)
+    {
+        if (failed_)
+            return false;
+        const TableSchema* schema = worker_->table_schema(table_name, [this](const std::string& query) {
+            pqxx::subtransaction explore(*work_, "pgi_explore");
+            pqxx::result r = explore.exec(query);
+            explore.commit();
+            return r;
+        });
+        if (schema)
+            return true;
+        failed_ = true;
+        std::cerr << "\nError : table " << table_name << " is unknown, the transaction will roll back\n";
+        return false;
+    }
+
+    pqxx::result execute_prepared(const PreparedStatement& statement, const pqxx::params& params)
+    {
+        pqxx::result r;
+        run(statement.definition, [&] {
+            connection_.prepare(statement);
+            r = work_->exec_prepared(statement.name, params);
+        });
+        return r;
+    }
+
+    /// Notes a table written to, whose cached results are dropped once the writes are committed.
+    void wrote(const std::string& table_name)
+    {
+        if (std::find(written_.begin(), written_.end(), table_name) == written_.end())
+            written_.push_back(table_name);
+    }
+
+    /// Runs f unless a previous statement failed, recording its failure.
+    template <typename F>
+    void run(const std::string& statement, F&& f)
+    {
+        if (failed_)
+            return;
+        try
+        {
+            f();
+        } catch (const std::exception& e)
+        {
+            failed_ = true;
+            std::cerr << "\nError : " << e.what() << "was raised while executing the following statement : \n"
+                      << statement << '\n';
+        }
+    }
+
+    DatabaseWorker* worker_;
+    // Declaration order matters: the transaction is destroyed before the connection is released
+    ConnectionPool::Lease connection_;
+    std::unique_ptr<pqxx::work> work_;
+    bool failed_ = false;
+    std::vector<std::string> written_;
+};
+
+inline Transaction DatabaseWorker::begin()
+{
+    return Transaction(*this, pool_->acquire());
+}
+
+}  // namespace pgi
@@ -0,0 +1,343 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "utl/bounded_queue.hpp"
+#include "classes/BatchController.hpp"
+#include "classes/ConnectionPool.hpp"
+
+namespace pgi {
+
+/// What producers do when the write-behind queue is full.
+enum class OverflowPolicy
+{
+    block,  ///< Wait until the flusher makes room.
+    drop    ///< Discard the row and count it in WriteBehindQueue::dropped().
+};
+
+struct WriteBehindOptions
+{
+    /// Maximum number of rows waiting to be written, whether still queued or held in a batch by the flusher.
+    std::size_t capacity = 65536;
+    /// Number of queued rows that triggers a flush.
+    std::size_t batch_size = 1000;
+    /// Maximum time a queued row waits before being flushed.
+    std::chrono::milliseconds flush_interval{100};
+    OverflowPolicy overflow_policy = OverflowPolicy::block;
+    /// When enabled, batch_size and flush_interval are only the initial values of each table, then tuned by a
+    /// BatchController from the measured writes.
+    AdaptiveBatchOptions adaptive;
+    /// Called on the flusher thread with each table whose queued rows were committed.
+    std::function<void(const std::string& table)> written;
+};
+
+/// Row waiting to be written, already encoded as a line of COPY text format.
+struct QueuedRow
+{
+    std::string table;
+    /// Quoted, comma separated column list matching the values of line.
+    std::string columns;
+    std::string line;
+};
+
+/// Queue of rows written to the database by a background thread.
+/// Rows are coalesced per (table, columns) and written through COPY, all the batches of a flush in one transaction.
+/// With adaptive batching, each table is written once it has its own batch size of rows or its oldest row waited
+/// its own flush interval, both tuned by a BatchController which the decisions are read from.
+class WriteBehindQueue
+{
+public:
+    WriteBehindQueue(
+        std::shared_ptr<ConnectionPool> pool, WriteBehindOptions options, std::shared_ptr<Metrics> metrics = nullptr)
+        : pool_(pool), options_(options), queue_(options.capacity)
+    {
+        options_.batch_size = std::max<std::size_t>(options_.batch_size, 1);
+        if (options_.adaptive.enabled)
+        {
+            controller_.reset(new BatchController(options_.adaptive, options_.batch_size, options_.flush_interval,
+                metrics));
+            wake_rows_ = controller_->min_batch_size();
+        }
+        else
+            wake_rows_ = options_.batch_size;
+        flusher_ = std::thread(&WriteBehindQueue::run, this);
+    }
+
+    WriteBehindQueue(const WriteBehindQueue&) = delete;
+    WriteBehindQueue& operator=(const WriteBehindQueue&) = delete;
+
+    /// Writes every queued row then stops the flusher.
+    ~WriteBehindQueue()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        flusher_.join();
+    }
+
+    /// Queues a row without waiting on the database.
+    /// Returns false if the row was dropped because the queue is full and the policy is OverflowPolicy::drop.
+    bool push(QueuedRow&& row)
+    {
+        // With a controller the flusher holds up to capacity rows in its batches, which count too
+        while ((controller_ && pending() >= options_.capacity) || !queue_.try_push(row))
+        {
+            if (options_.overflow_policy == OverflowPolicy::drop)
+            {
+                dropped_++;
+                return false;
+            }
+            wake_.notify_one();
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        if ((enqueued_.fetch_add(1) + 1) % wake_rows_.load(std::memory_order_relaxed) == 0)
+            wake_.notify_one();
+        return true;
+    }
+
+    /// Returns once every row pushed before the call has been written (or has failed to be).
+    void flush()
+    {
+        std::size_t target = enqueued_.load();
+        std::unique_lock<std::mutex> lock(mutex_);
+        flush_requests_++;
+        wake_.notify_one();
+        done_.wait(lock, [&] { return flushed_.load() >= target; });
+        flush_requests_--;
+    }
+
+    /// Number of rows discarded because the queue was full.
+    std::size_t dropped() const { return dropped_.load(); }
+    /// Number of rows whose batch failed to be written.
+    std::size_t failed() const { return failed_.load(); }
+    /// Number of rows queued and not written yet.
+    std::size_t pending() const
+    {
+        std::size_t flushed = flushed_.load();
+        std::size_t enqueued = enqueued_.load();
+        return enqueued > flushed ? enqueued - flushed : 0;
+    }
+
+    /// Adaptive batching controller, null unless WriteBehindOptions::adaptive is enabled.
+    std::shared_ptr<BatchController> batch_controller() const { return controller_; }
+
+private:
+    struct Batch
+    {
+        std::string table;
+        std::string columns;
+        std::vector<std::string> lines;
+        /// Rows triggering the write of this batch and longest wait of its rows, from the controller.
+        std::size_t batch_size = 0;
+        std::chrono::milliseconds flush_interval{0};
+        std::chrono::steady_clock::time_point oldest;
+    };
+
+    void run()
+    {
+        using clock = std::chrono::steady_clock;
+        std::unordered_map<std::string, Batch> batches;
+        std::size_t pending = 0;
+        auto oldest = clock::now();
+        std::string key;
+        QueuedRow row;
+        for (;;)
+        {
+            // Each table has its own batch size with a controller, rows are then held up to the queue capacity
+            std::size_t limit = controller_ ? options_.capacity : options_.batch_size;
+            bool full = false;
+            while (!full && pending < limit && queue_.try_pop(row))
+            {
+                auto now = clock::now();
+                if (pending == 0)
+                    oldest = now;
+                key = row.table;
+                key += '\n';
+                key += row.columns;
+                Batch& batch = batches[key];
+                if (batch.table.empty())
+                {
+                    batch.table = std::move(row.table);
+                    batch.columns = std::move(row.columns);
+                    refresh(batch);
+                }
+                if (batch.lines.empty())
+                    batch.oldest = now;
+                batch.lines.push_back(std::move(row.line));
+                pending++;
+                full = controller_ && batch.lines.size() >= batch.batch_size;
+            }
+
+            bool stopping;
+            bool flush_requested;
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                stopping = stopping_;
+                flush_requested = flush_requests_ > 0;
+            }
+            auto now = clock::now();
+            auto age = now - oldest;
+            std::size_t written = 0;
+            auto timeout = options_.flush_interval;
+            // Producers wait for room once the held and queued rows reach the capacity
+            bool at_capacity = controller_ && this->pending() >= options_.capacity;
+            if (pending > 0 && (flush_requested || stopping || at_capacity))
+                written = write(batches, nullptr);
+            else if (pending > 0 && !controller_)
+            {
+                if (pending >= options_.batch_size || age >= options_.flush_interval)
+                    written = write(batches, nullptr);
+                else
+                    timeout = std::chrono::duration_cast<std::chrono::milliseconds>(options_.flush_interval - age);
+            }
+            else if (pending > 0)
+            {
+                // Only the tables due are written, the others keep filling their batches
+                auto due = [&](const Batch& b) {
+                    return b.lines.size() >= b.batch_size || now - b.oldest >= b.flush_interval;
+                };
+                written = write(batches, due);
+                timeout = options_.adaptive.max_interval;
+                for (auto const& [k, b] : batches)
+                    if (!b.lines.empty())
+                        timeout = std::min(timeout,
+                            std::chrono::duration_cast<std::chrono::milliseconds>(b.flush_interval - (now - b.oldest)));
+            }
+            if (written > 0)
+            {
+                flushed_ += written;
+                pending -= written;
+                {
+                    // Synchronise with flush() so that its wait cannot miss this notification
+                    std::lock_guard<std::mutex> guard(mutex_);
+                }
+                done_.notify_all();
+                continue;
+            }
+            if (stopping && pending == 0 && enqueued_.load() == flushed_.load())
+                return;
+            // Rows left in the queue while a batch is full are popped after its write
+            if (full)
+                continue;
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            timeout = std::max(timeout, std::chrono::milliseconds(1));
+            // Rows held in batches that are not due yet do not wake the flusher
+            std::size_t held = controller_ ? pending : 0;
+            wake_.wait_for(lock, timeout, [this, held] {
+                // pending() does not wrap when rows are written before push() counted them
+                std::size_t queued = this->pending();
+                return stopping_ || flush_requests_ > 0 || (controller_ && queued >= options_.capacity) ||
+                    (queued > held && queued - held >= wake_rows_.load(std::memory_order_relaxed));
+            });
+        }
+    }
+
+    /// Sets the batch size and flush interval of a batch, from the controller if any.
+    void refresh(Batch& batch)
+    {
+        if (controller_)
+        {
+            batch.batch_size = controller_->batch_size(batch.table);
+            batch.flush_interval = controller_->flush_interval(batch.table);
+        }
+        else
+        {
+            batch.batch_size = options_.batch_size;
+            batch.flush_interval = options_.flush_interval;
+        }
+    }
+
+    /// Writes the batches for which due returns true (every non empty one if due is null) in one transaction.
+    /// Returns the number of rows written or failed.
+    template <typename Due>
+    std::size_t write(std::unordered_map<std::string, Batch>& batches, Due due)
+    {
+        std::vector<Batch*> selected;
+        std::size_t rows = 0;
+        for (auto& [key, batch] : batches)
+        {
+            if (batch.lines.empty())
+                continue;
+            if constexpr (!std::is_same<Due, std::nullptr_t>::value)
+                if (!due(batch))
+                    continue;
+            selected.push_back(&batch);
+            rows += batch.lines.size();
+        }
+        if (selected.empty())
+            return 0;
+        auto start = std::chrono::steady_clock::now();
+        try
+        {
+            pool_->run([&](ConnectionPool::Lease& c) {
+                pqxx::work w(*c);
+                for (Batch* b : selected)
+                {
+                    Batch& batch = *b;
+                    pqxx::stream_to stream = pqxx::stream_to::raw_table(w, batch.table, batch.columns);
+                    for (auto const& line : batch.lines)
+                        stream.write_raw_line(line);
+                    stream.complete();
+                }
+                w.commit();
+            });
+            if (controller_)
+            {
+                auto duration = std::chrono::steady_clock::now() - start;
+                for (Batch* b : selected)
+                    controller_->record(b->table, b->lines.size(), duration);
+            }
+            if (options_.written)
+                for (Batch* b : selected)
+                    options_.written(b->table);
+        } catch (const std::exception& e)
+        {
+            failed_ += rows;
+            std::cerr << "\nError : " << e.what() << "was raised while flushing " << rows << " queued rows\n";
+        }
+        for (Batch* b : selected)
+        {
+            b->lines.clear();
+            if (controller_)
+                refresh(*b);
+        }
+        if (controller_)
+            wake_rows_ = controller_->min_batch_size();
+        return rows;
+    }
+
+    std::shared_ptr<ConnectionPool> pool_;
+    WriteBehindOptions options_;
+    utl::BoundedQueue<QueuedRow> queue_;
+
+    std::atomic<std::size_t> enqueued_{0};
+    std::atomic<std::size_t> flushed_{0};
+    std::atomic<std::size_t> dropped_{0};
+    std::atomic<std::size_t> failed_{0};
+    /// Number of rows worth waking the flusher for.
+    std::atomic<std::size_t> wake_rows_{1};
+    std::shared_ptr<BatchController> controller_;
+
+    /// Guards stopping_ and flush_requests_, and pairs with the condition variables.
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    bool stopping_ = false;
+    int flush_requests_ = 0;
+
+    std::thread flusher_;
+};
+
+}  // namespace pgi
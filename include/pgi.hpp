@@ -5,6 +5,8 @@
 #include "yaml-cpp/yaml.h"
 
 #include "classes/DatabaseWorker.hpp"
+#include "classes/Pipeline.hpp"
+#include "classes/Transaction.hpp"
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace utl {
+
+/**
+ * Bounded lock-free queue usable by many producers and consumers (D. Vyukov's array based algorithm).
+ * The capacity is rounded up to a power of two. try_push and try_pop never block and never allocate.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (std::size_t i = 0; i < size; i++)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_.store(0, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /// Moves value into the queue. Returns false, leaving value untouched, if the queue is full.
+    bool try_push(T& value)
+    {
+        Cell* cell;
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t dif = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+            if (dif == 0)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false;
+            else
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+        cell->data = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Moves the oldest element into value. Returns false if the queue is empty.
+    bool try_pop(T& value)
+    {
+        Cell* cell;
+        std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t dif = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+            if (dif == 0)
+            {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false;
+            else
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+        }
+        value = std::move(cell->data);
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    std::size_t mask_;
+    alignas(64) std::atomic<std::size_t> enqueue_pos_;
+    alignas(64) std::atomic<std::size_t> dequeue_pos_;
+};
+
+}  // namespace utl
@@ -0,0 +1,101 @@
+#pragma once
+#include <charconv>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "datetime.hpp"
+#include "map_utls.hpp"
+
+namespace utl {
+
+/**
+ * Appends a value to a line of COPY text format (see postgres COPY documentation, "Text Format").
+ * Numerics are written with std::to_chars, strings are escaped, time points are written as ISO 8601.
+ */
+inline void append_copy_value(std::string& line, const std::string& val)
+{
+    for (char c : val)
+    {
+        switch (c)
+        {
+            case '\\': line += "\\\\"; break;
+            case '\t': line += "\\t"; break;
+            case '\n': line += "\\n"; break;
+            case '\r': line += "\\r"; break;
+            default: line += c;
+        }
+    }
+}
+
+inline void append_copy_value(std::string& line, const time_point_t& val)
+{
+    append_ISO_8601(line, val);
+}
+
+inline void append_copy_value(std::string& line, bool val)
+{
+    line += val ? 't' : 'f';
+}
+
+template <typename T>
+std::enable_if_t<std::is_arithmetic<T>::value> append_copy_value(std::string& line, const T& val)
+{
+    char buf[64];
+    auto res = std::to_chars(buf, buf + sizeof(buf), val);
+    line.append(buf, res.ptr);
+}
+
+/**
+ * Appends the i-th element of every column of a column map but the shadowed ones to a COPY text line, each
+ * followed by a tab. The caller removes the trailing tab once all the maps of the row have been appended.
+ */
+template <typename T>
+void append_copy_row(std::string& line,
+    const std::map<std::string, std::vector<T>>& columns,
+    std::size_t i,
+    const ShadowedKeys& shadowed)
+{
+    for (auto const& [key, val_vec] : columns)
+    {
+        if (shadowed.contains(key))
+            continue;
+        append_copy_value(line, val_vec[i]);
+        line += '\t';
+    }
+}
+
+/**
+ * Appends every value of a map<std::string, T> but the shadowed ones to a COPY text line, each followed by a tab.
+ */
+template <typename T>
+void append_copy_values(std::string& line, const std::map<std::string, T>& map, const ShadowedKeys& shadowed)
+{
+    for (auto const& [key, val] : map)
+    {
+        if (shadowed.contains(key))
+            continue;
+        append_copy_value(line, val);
+        line += '\t';
+    }
+}
+
+/**
+ * Appends the quoted column names of a column map but the shadowed ones to a comma separated list.
+ */
+template <typename T>
+void append_copy_columns(std::string& columns, const std::map<std::string, T>& map, const ShadowedKeys& shadowed)
+{
+    for (auto const& [key, val] : map)
+    {
+        if (shadowed.contains(key))
+            continue;
+        if (!columns.empty())
+            columns += ", ";
+        columns += '"';
+        columns += key;
+        columns += '"';
+    }
+}
+
+}  // namespace utl
@@ -2,23 +2,284 @@
 
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <ctime>
+#include <limits>
+#include <string>
+#include <string_view>
 
 #define time_point_t std::chrono::time_point<std::chrono::system_clock>
 
 namespace utl {
 
-std::string ISO_8601(time_point_t tp)
+/**
+ * Second resolution part of a formatted time point: "YYYY-MM-DD HH:MM:SS" and its UTC offset in seconds.
+ * Formatting is cached per thread, so that consecutive time points within the same second reuse it.
+ */
+struct formatted_second
 {
-    std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch());
+    long long second = std::numeric_limits<long long>::min();
+    char prefix[19];
+    long offset = 0;
+};
 
-    std::chrono::seconds s = std::chrono::duration_cast<std::chrono::seconds>(ms);
-    std::time_t t = s.count();
-    std::size_t fractional_seconds = ms.count() % 1000;
+inline void write_digits(char* out, long val, int digits)
+{
+    for (int i = digits - 1; i >= 0; i--, val /= 10)
+        out[i] = char('0' + val % 10);
+}
+
+/**
+ * Proleptic Gregorian date of a number of days since 1970-01-01 (H. Hinnant's civil_from_days).
+ */
+inline void civil_from_days(long z, long& y, unsigned& m, unsigned& d)
+{
+    z += 719468;
+    const long era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = static_cast<long>(yoe) + era * 400 + (m <= 2);
+}
+
+inline void write_prefix(char* out, long y, unsigned m, unsigned d, int hour, int minute, int second)
+{
+    write_digits(out, y, 4);
+    out[4] = '-';
+    write_digits(out + 5, m, 2);
+    out[7] = '-';
+    write_digits(out + 8, d, 2);
+    out[10] = ' ';
+    write_digits(out + 11, hour, 2);
+    out[13] = ':';
+    write_digits(out + 14, minute, 2);
+    out[16] = ':';
+    write_digits(out + 17, second, 2);
+}
+
+/**
+ * Returns the formatting of a second in local time (localtime_r, thread safe).
+ */
+inline const formatted_second& local_second(long long second)
+{
+    thread_local formatted_second cache;
+    if (cache.second != second)
+    {
+        std::time_t t = static_cast<std::time_t>(second);
+        std::tm tm = {};
+        localtime_r(&t, &tm);
+        write_prefix(cache.prefix, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        cache.offset = tm.tm_gmtoff;
+        cache.second = second;
+    }
+    return cache;
+}
+
+/**
+ * Returns the formatting of a second in UTC, computed without the C library.
+ */
+inline const formatted_second& utc_second(long long second)
+{
+    thread_local formatted_second cache;
+    if (cache.second != second)
+    {
+        long long days = second >= 0 ? second / 86400 : (second - 86399) / 86400;
+        long long in_day = second - days * 86400;
+        long y;
+        unsigned m, d;
+        civil_from_days(static_cast<long>(days), y, m, d);
+        write_prefix(cache.prefix, y, m, d, int(in_day / 3600), int(in_day / 60 % 60), int(in_day % 60));
+        cache.offset = 0;
+        cache.second = second;
+    }
+    return cache;
+}
+
+/**
+ * Appends "YYYY-MM-DD HH:MM:SS.ffffff+HH:MM" to out: the prefix of the second, microseconds and UTC offset.
+ * The offset ends with ":SS" when it has seconds, as local mean time zones do before 1900 or so.
+ */
+inline void append_formatted(std::string& out, const formatted_second& sec, long micros)
+{
+    char buf[35];
+    std::copy(sec.prefix, sec.prefix + 19, buf);
+    buf[19] = '.';
+    write_digits(buf + 20, micros, 6);
+    long offset = sec.offset;
+    buf[26] = offset < 0 ? '-' : '+';
+    if (offset < 0)
+        offset = -offset;
+    write_digits(buf + 27, offset / 3600, 2);
+    buf[29] = ':';
+    write_digits(buf + 30, offset / 60 % 60, 2);
+    std::size_t size = 32;
+    if (offset % 60)
+    {
+        buf[32] = ':';
+        write_digits(buf + 33, offset % 60, 2);
+        size = 35;
+    }
+    out.append(buf, size);
+}
+
+/**
+ * Splits a time point into seconds since 1970-01-01 and microseconds within that second.
+ */
+inline void split_seconds(time_point_t tp, long long& second, long& micros)
+{
+    long long us = std::chrono::duration_cast<std::chrono::microseconds>(tp.time_since_epoch()).count();
+    second = us >= 0 ? us / 1000000 : (us - 999999) / 1000000;
+    micros = static_cast<long>(us - second * 1000000);
+}
+
+/**
+ * Appends a time point in local time with its explicit offset, e.g. "2021-12-01 11:32:38.112000+01:00".
+ * Thread safe; the date and time part is formatted once per second and thread.
+ */
+inline void append_ISO_8601(std::string& out, time_point_t tp)
+{
+    long long second;
+    long micros;
+    split_seconds(tp, second, micros);
+    append_formatted(out, local_second(second), micros);
+}
+
+/**
+ * Appends a time point in UTC, e.g. "2021-12-01 10:32:38.112000+00:00".
+ */
+inline void append_ISO_8601_UTC(std::string& out, time_point_t tp)
+{
+    long long second;
+    long micros;
+    split_seconds(tp, second, micros);
+    append_formatted(out, utc_second(second), micros);
+}
+
+/**
+ * Time point in local time with its explicit offset. timestamptz columns get the exact instant, while
+ * timestamp columns ignore the offset and keep the local time.
+ */
+inline std::string ISO_8601(time_point_t tp)
+{
+    std::string out;
+    append_ISO_8601(out, tp);
+    return out;
+}
+
+inline std::string ISO_8601_UTC(time_point_t tp)
+{
+    std::string out;
+    append_ISO_8601_UTC(out, tp);
+    return out;
+}
+
+/**
+ * Binary representation of a timestamp / timestamptz parameter: big endian microseconds since
+ * 2000-01-01 00:00:00, in UTC for timestamptz or in local time for timestamp (see ISO_8601).
+ */
+inline std::basic_string<std::byte> timestamp_binary(time_point_t tp, bool local)
+{
+    constexpr long long postgres_epoch = 946684800;  // 2000-01-01 in seconds since 1970-01-01
+    long long second;
+    long micros;
+    split_seconds(tp, second, micros);
+    if (local)
+        second += local_second(second).offset;
+    unsigned long long val = static_cast<unsigned long long>((second - postgres_epoch) * 1000000 + micros);
+    std::basic_string<std::byte> bytes(8, std::byte{0});
+    for (int i = 7; i >= 0; i--, val >>= 8)
+        bytes[i] = std::byte(val & 0xff);
+    return bytes;
+}
+
+/**
+ * Days since 1970-01-01 of a proleptic Gregorian date (H. Hinnant's days_from_civil).
+ */
+inline long days_from_civil(long y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    const long era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<long>(doe) - 719468;
+}
+
+/**
+ * Parses a postgres timestamp / timestamptz text value: "YYYY-MM-DD HH:MM:SS[.ffffff][+HH[:MM[:SS]]]".
+ * Values without offset are taken as local time, like the ones written by ISO_8601.
+ */
+inline time_point_t parse_timestamp(std::string_view str)
+{
+    const char* p = str.data();
+    const char* end = str.data() + str.size();
+    auto number = [&](std::size_t digits) {
+        int val = 0;
+        const char* stop = std::min(p + digits, end);
+        p = std::from_chars(p, stop, val).ptr;
+        return val;
+    };
+    auto skip = [&]() {
+        if (p < end)
+            p++;
+    };
+
+    int year = number(4);
+    skip();
+    int month = number(2);
+    skip();
+    int day = number(2);
+    skip();
+    int hour = number(2);
+    skip();
+    int minute = number(2);
+    skip();
+    int second = number(2);
+
+    std::chrono::microseconds fraction(0);
+    if (p < end && *p == '.')
+    {
+        p++;
+        long scale = 100000;
+        for (; p < end && *p >= '0' && *p <= '9'; p++, scale /= 10)
+            fraction += std::chrono::microseconds((*p - '0') * scale);
+    }
+
+    if (p < end && (*p == '+' || *p == '-'))
+    {
+        int sign = *p == '-' ? -1 : 1;
+        p++;
+        int offset = number(2) * 3600;
+        if (p < end && *p == ':')
+        {
+            p++;
+            offset += number(2) * 60;
+            if (p < end && *p == ':')
+            {
+                p++;
+                offset += number(2);
+            }
+        }
+        long days = days_from_civil(year, month, day);
+        std::chrono::seconds utc(days * 86400 + hour * 3600 + minute * 60 + second - sign * offset);
+        return time_point_t(std::chrono::duration_cast<time_point_t::duration>(utc + fraction));
+    }
 
-    std::stringstream ss;
-    ss << std::put_time(std::localtime(&t), "%Y-%m-%d %T") << "." << std::setw(3) << std::setfill('0')
-       << fractional_seconds;
-    return ss.str();
+    std::tm tm = {};
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    tm.tm_sec = second;
+    tm.tm_isdst = -1;
+    return std::chrono::system_clock::from_time_t(std::mktime(&tm)) +
+           std::chrono::duration_cast<time_point_t::duration>(fraction);
 }
 
 }  // namespace utl
\ No newline at end of file
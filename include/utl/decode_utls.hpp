@@ -0,0 +1,86 @@
+#pragma once
+#include <charconv>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "datetime.hpp"
+#include "packed_utls.hpp"
+
+namespace utl {
+
+/**
+ * Decodes a postgres text format value. Null values (null data) decode to a value-initialised T,
+ * or a quiet NaN for floating point types.
+ */
+template <typename T>
+std::enable_if_t<std::is_arithmetic<T>::value> decode_value(std::string_view text, T& val)
+{
+    if (text.data() == nullptr)
+    {
+        val = std::numeric_limits<T>::has_quiet_NaN ? std::numeric_limits<T>::quiet_NaN() : T();
+        return;
+    }
+    val = T();
+    std::from_chars(text.data(), text.data() + text.size(), val);
+}
+
+inline void decode_value(std::string_view text, bool& val)
+{
+    val = !text.empty() && text[0] == 't';
+}
+
+inline void decode_value(std::string_view text, std::string& val)
+{
+    if (text.data() == nullptr)
+        val.clear();
+    else
+        val.assign(text.data(), text.size());
+}
+
+inline void decode_value(std::string_view text, time_point_t& val)
+{
+    val = text.data() == nullptr ? time_point_t() : parse_timestamp(text);
+}
+
+/**
+ * Decodes a one dimensional array ("{1.5,2,NULL}") or a bytea made by pack() ("\\x02..."). Null values and
+ * values in any other format decode to an empty vector.
+ */
+template <typename T>
+void decode_value(std::string_view text, std::vector<T>& val)
+{
+    val.clear();
+    if (text.size() >= 2 && text.front() == '{' && text.back() == '}')
+    {
+        text = text.substr(1, text.size() - 2);
+        while (!text.empty())
+        {
+            std::size_t comma = text.find(',');
+            std::string_view element = text.substr(0, comma);
+            decode_value(element == "NULL" ? std::string_view() : element, val.emplace_back());
+            text = comma == std::string_view::npos ? std::string_view() : text.substr(comma + 1);
+        }
+        return;
+    }
+    if constexpr (std::is_arithmetic<T>::value)
+    {
+        byte_string bytes;
+        if (hex_bytes(text, bytes))
+            unpack(bytes.data(), bytes.size(), val);
+    }
+}
+
+/**
+ * Appends the I-th value of a row to the I-th vector of a tuple of column vectors.
+ */
+template <typename Row, typename... Ts, std::size_t... I>
+void append_decoded_row(std::tuple<std::vector<Ts>...>& columns, const Row& row, std::index_sequence<I...>)
+{
+    (decode_value(std::string_view(row[I].data(), row[I].size()), std::get<I>(columns).emplace_back()), ...);
+}
+
+}  // namespace utl
@@ -1,6 +1,8 @@
 #pragma once
+#include <algorithm>
 #include <string>
 #include <map>
+#include <vector>
 #include "string_utls.hpp"
 
 namespace utl {
@@ -38,4 +40,46 @@ std::map<std::string, std::vector<std::string>> merge_maps(const std::map<std::s
     return final_map;
 }
 
-}  // namespace utl
\ No newline at end of file
+/**
+ * Keys of a list of maps that an earlier map of the list already has. As with merge_maps, the statements built
+ * from several maps take each key from the first map that has it and skip it in the later ones.
+ */
+class ShadowedKeys
+{
+public:
+    template <typename... Maps>
+    explicit ShadowedKeys(const Maps&... maps)
+    {
+        collect(maps...);
+    }
+
+    /// Whether key, the key of an element of one of the maps, is already in an earlier map.
+    bool contains(const std::string& key) const
+    {
+        return !keys_.empty() && std::find(keys_.begin(), keys_.end(), &key) != keys_.end();
+    }
+
+private:
+    template <typename First, typename... Rest>
+    void collect(const First& first, const Rest&... rest)
+    {
+        if constexpr (sizeof...(rest) > 0)
+        {
+            (shadow(first, rest), ...);
+            collect(rest...);
+        }
+    }
+
+    template <typename Earlier, typename Later>
+    void shadow(const Earlier& earlier, const Later& later)
+    {
+        for (auto const& [key, val] : later)
+            if (earlier.count(key) && !contains(key))
+                keys_.push_back(&key);
+    }
+
+    // Addresses of the keys in the maps, so that a key is only skipped in the maps after the first one having it
+    std::vector<const std::string*> keys_;
+};
+
+}  // namespace utl
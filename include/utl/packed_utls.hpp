@@ -0,0 +1,408 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace utl {
+
+using byte_string = std::basic_string<std::byte>;
+
+constexpr pqxx::oid bytea_oid = 17;
+constexpr pqxx::oid int2_array_oid = 1005;
+constexpr pqxx::oid int4_array_oid = 1007;
+constexpr pqxx::oid int8_array_oid = 1016;
+constexpr pqxx::oid float4_array_oid = 1021;
+constexpr pqxx::oid float8_array_oid = 1022;
+
+/**
+ * Compression of a vector packed into a bytea column, see pack().
+ * raw stores every value on 8 bytes, delta the zigzag varint of the difference with the previous value, gorilla
+ * the XOR with the previous value restricted to its meaningful bits (Pelkonen et al., "Gorilla: a fast, scalable,
+ * in-memory time series database"). Values are taken as 64 bits integers, or as the bits of a double for floating
+ * point types: delta suits integer counters, gorilla slowly varying measures.
+ */
+enum class PackedCodec : unsigned char
+{
+    raw = 0,
+    delta = 1,
+    gorilla = 2
+};
+
+template <typename T>
+constexpr PackedCodec default_codec()
+{
+    return std::is_floating_point<T>::value ? PackedCodec::gorilla : PackedCodec::delta;
+}
+
+inline void append_big_endian(byte_string& out, std::uint64_t val, int size)
+{
+    for (int i = size - 1; i >= 0; i--)
+        out.push_back(std::byte((val >> (8 * i)) & 0xff));
+}
+
+/**
+ * Binary format of a one dimensional array of the given array type (int2[], int4[], int8[], float4[] or float8[]),
+ * as sent by a binary parameter. Returns an empty string for any other type.
+ */
+template <typename T>
+byte_string array_binary(const std::vector<T>& values, pqxx::oid array_type)
+{
+    static_assert(std::is_arithmetic<T>::value, "Array elements must be arithmetic");
+    pqxx::oid element;
+    int size;
+    switch (array_type)
+    {
+        case int2_array_oid: element = 21, size = 2; break;
+        case int4_array_oid: element = 23, size = 4; break;
+        case int8_array_oid: element = 20, size = 8; break;
+        case float4_array_oid: element = 700, size = 4; break;
+        case float8_array_oid: element = 701, size = 8; break;
+        default: return byte_string();
+    }
+    bool floating = element == 700 || element == 701;
+    byte_string out;
+    out.reserve(20 + values.size() * (4 + size));
+    // ndim, has null, element type, then the length and lower bound of the dimension
+    append_big_endian(out, values.empty() ? 0 : 1, 4);
+    append_big_endian(out, 0, 4);
+    append_big_endian(out, element, 4);
+    if (!values.empty())
+    {
+        append_big_endian(out, values.size(), 4);
+        append_big_endian(out, 1, 4);
+    }
+    for (T value : values)
+    {
+        append_big_endian(out, std::uint64_t(size), 4);
+        std::uint64_t bits;
+        if (floating && size == 4)
+        {
+            float f = static_cast<float>(value);
+            std::uint32_t b;
+            std::memcpy(&b, &f, sizeof(b));
+            bits = b;
+        }
+        else if (floating)
+        {
+            double d = static_cast<double>(value);
+            std::memcpy(&bits, &d, sizeof(bits));
+        }
+        else
+            bits = static_cast<std::uint64_t>(static_cast<long long>(value));
+        append_big_endian(out, bits, size);
+    }
+    return out;
+}
+
+/**
+ * Value of T as the 64 bits packed by pack(), and back.
+ */
+template <typename T>
+std::uint64_t packed_bits(T value)
+{
+    if constexpr (std::is_floating_point<T>::value)
+    {
+        double d = static_cast<double>(value);
+        std::uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        return bits;
+    }
+    else
+        return static_cast<std::uint64_t>(static_cast<long long>(value));
+}
+
+template <typename T>
+T unpacked_value(std::uint64_t bits, bool floating)
+{
+    if (!floating)
+        return static_cast<T>(static_cast<long long>(bits));
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return static_cast<T>(d);
+}
+
+inline int leading_zeros(std::uint64_t val)
+{
+#if defined(__GNUC__)
+    return val ? __builtin_clzll(val) : 64;
+#else
+    int n = 0;
+    for (std::uint64_t bit = std::uint64_t(1) << 63; bit && !(val & bit); bit >>= 1)
+        n++;
+    return n;
+#endif
+}
+
+inline int trailing_zeros(std::uint64_t val)
+{
+#if defined(__GNUC__)
+    return val ? __builtin_ctzll(val) : 64;
+#else
+    int n = 0;
+    for (std::uint64_t bit = 1; bit && !(val & bit); bit <<= 1)
+        n++;
+    return n;
+#endif
+}
+
+/**
+ * Appends bits most significant first.
+ */
+class BitWriter
+{
+public:
+    explicit BitWriter(byte_string& out) : out_(out) {}
+
+    void write(std::uint64_t val, int bits)
+    {
+        while (bits > 0)
+        {
+            if (used_ == 0)
+                out_.push_back(std::byte{0});
+            int n = std::min(8 - used_, bits);
+            std::uint64_t chunk = (val >> (bits - n)) & ((std::uint64_t(1) << n) - 1);
+            out_.back() |= std::byte(chunk << (8 - used_ - n));
+            used_ = (used_ + n) % 8;
+            bits -= n;
+        }
+    }
+
+private:
+    byte_string& out_;
+    int used_ = 0;
+};
+
+/**
+ * Reads bits written by BitWriter. Reading past the end sets failed() and returns zeros.
+ */
+class BitReader
+{
+public:
+    BitReader(const std::byte* data, std::size_t size) : data_(data), size_(size) {}
+
+    std::uint64_t read(int bits)
+    {
+        std::uint64_t val = 0;
+        while (bits > 0)
+        {
+            if (position_ / 8 >= size_)
+            {
+                failed_ = true;
+                return 0;
+            }
+            int used = int(position_ % 8);
+            int n = std::min(8 - used, bits);
+            std::uint64_t byte = std::to_integer<std::uint64_t>(data_[position_ / 8]);
+            val = (val << n) | ((byte >> (8 - used - n)) & ((std::uint64_t(1) << n) - 1));
+            position_ += n;
+            bits -= n;
+        }
+        return val;
+    }
+
+    bool failed() const { return failed_; }
+
+private:
+    const std::byte* data_;
+    std::size_t size_;
+    std::size_t position_ = 0;
+    bool failed_ = false;
+};
+
+inline void append_varint(byte_string& out, std::uint64_t val)
+{
+    while (val >= 0x80)
+    {
+        out.push_back(std::byte((val & 0x7f) | 0x80));
+        val >>= 7;
+    }
+    out.push_back(std::byte(val));
+}
+
+inline bool read_varint(const std::byte*& it, const std::byte* end, std::uint64_t& val)
+{
+    val = 0;
+    for (int shift = 0; it != end && shift < 64; shift += 7)
+    {
+        std::uint64_t byte = std::to_integer<std::uint64_t>(*it++);
+        val |= (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Packs a vector into the bytea value decoded by unpack(): the codec, whether the values are floating point,
+ * their count as a varint, then the values compressed by the codec.
+ */
+template <typename T>
+byte_string pack(const std::vector<T>& values, PackedCodec codec = default_codec<T>())
+{
+    static_assert(std::is_arithmetic<T>::value, "Packed values must be arithmetic");
+    byte_string out;
+    out.reserve(values.size() * (codec == PackedCodec::raw ? 8 : 2) + 12);
+    out.push_back(std::byte(codec));
+    out.push_back(std::byte(std::is_floating_point<T>::value ? 1 : 0));
+    append_varint(out, values.size());
+    std::uint64_t previous = 0;
+    if (codec == PackedCodec::raw)
+        for (T value : values)
+            append_big_endian(out, packed_bits(value), 8);
+    else if (codec == PackedCodec::delta)
+        for (T value : values)
+        {
+            std::uint64_t bits = packed_bits(value);
+            std::uint64_t delta = bits - previous;
+            append_varint(out, (delta << 1) ^ (std::uint64_t(0) - (delta >> 63)));
+            previous = bits;
+        }
+    else
+    {
+        BitWriter writer(out);
+        int leading = -1, trailing = 0;
+        for (std::size_t i = 0; i < values.size(); i++)
+        {
+            std::uint64_t bits = packed_bits(values[i]);
+            std::uint64_t x = bits ^ previous;
+            previous = bits;
+            if (i == 0)
+                writer.write(bits, 64);
+            else if (x == 0)
+                writer.write(0, 1);
+            else
+            {
+                int lz = std::min(leading_zeros(x), 31), tz = trailing_zeros(x);
+                if (leading >= 0 && lz >= leading && tz >= trailing)
+                {
+                    // The meaningful bits fit in the previous window
+                    writer.write(2, 2);
+                    writer.write(x >> trailing, 64 - leading - trailing);
+                }
+                else
+                {
+                    int length = 64 - lz - tz;
+                    writer.write(3, 2);
+                    writer.write(std::uint64_t(lz), 5);
+                    writer.write(std::uint64_t(length & 63), 6);
+                    writer.write(x >> tz, length);
+                    leading = lz;
+                    trailing = tz;
+                }
+            }
+        }
+    }
+    return out;
+}
+
+/**
+ * Decodes a value made by pack() into values. Returns false, values being empty, if it is malformed.
+ */
+template <typename T>
+bool unpack(const std::byte* data, std::size_t size, std::vector<T>& values)
+{
+    values.clear();
+    const std::byte* it = data;
+    const std::byte* end = data + size;
+    std::uint64_t count;
+    if (size < 3 || std::to_integer<int>(data[0]) > 2)
+        return false;
+    PackedCodec codec = PackedCodec(std::to_integer<unsigned char>(*it++));
+    bool floating = std::to_integer<int>(*it++) != 0;
+    // Every value takes at least one bit
+    if (!read_varint(it, end, count) || count > std::uint64_t(end - it) * 8 + 64)
+        return false;
+    values.reserve(count);
+    std::uint64_t previous = 0;
+    if (codec == PackedCodec::raw)
+    {
+        if (std::uint64_t(end - it) < count * 8)
+            return false;
+        for (std::uint64_t i = 0; i < count; i++)
+        {
+            std::uint64_t bits = 0;
+            for (int b = 0; b < 8; b++)
+                bits = (bits << 8) | std::to_integer<std::uint64_t>(*it++);
+            values.push_back(unpacked_value<T>(bits, floating));
+        }
+    }
+    else if (codec == PackedCodec::delta)
+        for (std::uint64_t i = 0; i < count; i++)
+        {
+            std::uint64_t zigzag;
+            if (!read_varint(it, end, zigzag))
+            {
+                values.clear();
+                return false;
+            }
+            previous += (zigzag >> 1) ^ (std::uint64_t(0) - (zigzag & 1));
+            values.push_back(unpacked_value<T>(previous, floating));
+        }
+    else
+    {
+        BitReader reader(it, std::size_t(end - it));
+        int leading = 0, trailing = 0;
+        for (std::uint64_t i = 0; i < count && !reader.failed(); i++)
+        {
+            if (i == 0)
+                previous = reader.read(64);
+            else if (reader.read(1))
+            {
+                if (reader.read(1))
+                {
+                    leading = int(reader.read(5));
+                    int length = int(reader.read(6));
+                    length = length ? length : 64;
+                    trailing = 64 - leading - length;
+                    if (trailing < 0)
+                        break;
+                }
+                previous ^= reader.read(64 - leading - trailing) << trailing;
+            }
+            values.push_back(unpacked_value<T>(previous, floating));
+        }
+        if (reader.failed() || values.size() != count)
+        {
+            values.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+inline int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Decodes the hex text format of a bytea ("\\x0a1b..."). Returns false if it is not one.
+ */
+inline bool hex_bytes(std::string_view text, byte_string& bytes)
+{
+    bytes.clear();
+    if (text.size() < 2 || text[0] != '\\' || text[1] != 'x' || text.size() % 2)
+        return false;
+    bytes.reserve(text.size() / 2 - 1);
+    for (std::size_t i = 2; i < text.size(); i += 2)
+    {
+        int high = hex_digit(text[i]), low = hex_digit(text[i + 1]);
+        if (high < 0 || low < 0)
+            return false;
+        bytes.push_back(std::byte(high * 16 + low));
+    }
+    return true;
+}
+
+}  // namespace utl
@@ -0,0 +1,159 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "datetime.hpp"
+
+namespace utl {
+
+/**
+ * Fixed capacity string usable in constant expressions.
+ */
+template <std::size_t N>
+struct fixed_string
+{
+    char data[N + 1] = {};
+    std::size_t size = 0;
+
+    constexpr void push_back(char c) { data[size++] = c; }
+    constexpr std::string_view view() const { return std::string_view(data, size); }
+};
+
+/**
+ * Turns a stringized field list ("a, b,c") into a quoted column list ("\"a\", \"b\", \"c\"") at compile time.
+ */
+template <std::size_t M>
+constexpr fixed_string<3 * M> quote_columns(const char (&fields)[M])
+{
+    fixed_string<3 * M> out;
+    bool in_name = false;
+    for (std::size_t i = 0; i + 1 < M; i++)
+    {
+        char c = fields[i];
+        if (c == ',' || c == ' ' || c == '\t' || c == '\n')
+        {
+            if (in_name)
+                out.push_back('"');
+            in_name = false;
+            if (c == ',')
+            {
+                out.push_back(',');
+                out.push_back(' ');
+            }
+        }
+        else
+        {
+            if (!in_name)
+                out.push_back('"');
+            in_name = true;
+            out.push_back(c);
+        }
+    }
+    if (in_name)
+        out.push_back('"');
+    return out;
+}
+
+template <std::size_t M>
+constexpr std::size_t count_columns(const char (&fields)[M])
+{
+    std::size_t count = 1;
+    for (std::size_t i = 0; i + 1 < M; i++)
+        if (fields[i] == ',')
+            count++;
+    return count;
+}
+
+/**
+ * Splits a quoted column list made by quote_columns back into the column names.
+ */
+inline std::vector<std::string_view> split_columns(std::string_view columns)
+{
+    std::vector<std::string_view> names;
+    std::size_t start = columns.find('"');
+    while (start != std::string_view::npos)
+    {
+        std::size_t stop = columns.find('"', start + 1);
+        names.push_back(columns.substr(start + 1, stop - start - 1));
+        start = columns.find('"', stop + 1);
+    }
+    return names;
+}
+
+template <typename F, typename... Ts>
+void apply_each(F& f, const Ts&... fields)
+{
+    (f(fields), ...);
+}
+
+/**
+ * Value bound to a statement parameter: time points are sent in ISO 8601, anything else as is.
+ */
+template <typename T>
+const T& param_value(const T& val)
+{
+    return val;
+}
+
+inline std::string param_value(const time_point_t& val)
+{
+    return ISO_8601(val);
+}
+
+constexpr pqxx::oid timestamp_oid = 1114;
+constexpr pqxx::oid timestamptz_oid = 1184;
+
+/**
+ * Appends a statement parameter bound to a column of the given type (0 if unknown). Time points bound to a
+ * timestamp or timestamptz column are sent in binary, skipping text formatting and parsing; anything else is
+ * sent as its param_value.
+ */
+template <typename T>
+void append_param(pqxx::params& params, const T& val, pqxx::oid)
+{
+    params.append(param_value(val));
+}
+
+inline void append_param(pqxx::params& params, const time_point_t& val, pqxx::oid type)
+{
+    if (type == timestamptz_oid || type == timestamp_oid)
+        params.append(timestamp_binary(val, type == timestamp_oid));
+    else
+        params.append(param_value(val));
+}
+
+/**
+ * Compile-time description of a row struct, specialised with PGI_ROW.
+ */
+template <typename T>
+struct row_traits
+{
+    static constexpr bool is_row = false;
+};
+
+}  // namespace utl
+
+/**
+ * Declares the columns of a row struct, for DatabaseWorker::insert<Row>(table, rows) and insert_row.
+ * Columns are bound by position (structured binding) and must name every member of the struct, in order:
+ *
+ *     struct SensorRow { time_point_t time; double value; };
+ *     PGI_ROW(SensorRow, time, value)
+ *
+ * Must be used at global namespace scope.
+ */
+#define PGI_ROW(Type, ...)                                                          \
+    template <>                                                                     \
+    struct utl::row_traits<Type>                                                    \
+    {                                                                               \
+        static constexpr bool is_row = true;                                        \
+        static constexpr auto columns = utl::quote_columns(#__VA_ARGS__);           \
+        static constexpr std::size_t size = utl::count_columns(#__VA_ARGS__);       \
+        template <typename F>                                                       \
+        static void for_each(const Type& row, F&& f)                                \
+        {                                                                           \
+            auto const& [__VA_ARGS__] = row;                                        \
+            utl::apply_each(f, __VA_ARGS__);                                        \
+        }                                                                           \
+    };
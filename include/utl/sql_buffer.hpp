@@ -0,0 +1,210 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "datetime.hpp"
+#include "map_utls.hpp"
+
+namespace utl {
+
+/**
+ * Growable statement buffer shared by the statement builders.
+ * Numbers are written with std::to_chars and the capacity is kept from one statement to the next, so that
+ * building a statement does not allocate once the buffer has grown to the usual statement size.
+ */
+class SqlBuffer
+{
+public:
+    /// Capacity kept by a released buffer, larger buffers give their memory back.
+    static constexpr std::size_t max_retained_capacity = 1 << 20;
+
+    /// Borrows a cleared thread local buffer. Nested leases on the same thread get distinct buffers.
+    class Lease
+    {
+    public:
+        Lease() : depth_(depth()++)
+        {
+            auto& buffers = pool();
+            if (buffers.size() <= depth_)
+                buffers.emplace_back(new SqlBuffer());
+            buffer_ = buffers[depth_].get();
+            buffer_->clear();
+        }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease()
+        {
+            if (buffer_->str_.capacity() > max_retained_capacity)
+                std::string().swap(buffer_->str_);
+            depth()--;
+        }
+
+        SqlBuffer& operator*() const { return *buffer_; }
+        SqlBuffer* operator->() const { return buffer_; }
+
+    private:
+        std::size_t depth_;
+        SqlBuffer* buffer_;
+    };
+
+    void clear() { str_.clear(); }
+    void reserve(std::size_t size) { str_.reserve(size); }
+    std::size_t size() const { return str_.size(); }
+    const std::string& str() const { return str_; }
+
+    /// Removes the last n characters, typically a trailing ", " separator.
+    SqlBuffer& drop_last(std::size_t n)
+    {
+        str_.resize(str_.size() - std::min(n, str_.size()));
+        return *this;
+    }
+
+    /// Appends raw SQL.
+    SqlBuffer& append(std::string_view sql)
+    {
+        str_.append(sql.data(), sql.size());
+        return *this;
+    }
+
+    SqlBuffer& append(char c)
+    {
+        str_ += c;
+        return *this;
+    }
+
+    /// Appends a double quoted identifier.
+    SqlBuffer& append_identifier(std::string_view name)
+    {
+        str_ += '"';
+        str_.append(name.data(), name.size());
+        str_ += '"';
+        return *this;
+    }
+
+    /// Appends a single quoted string literal, doubling its single quotes.
+    SqlBuffer& append_literal(std::string_view val)
+    {
+        str_ += '\'';
+        for (char c : val)
+        {
+            if (c == '\'')
+                str_ += '\'';
+            str_ += c;
+        }
+        str_ += '\'';
+        return *this;
+    }
+
+    template <typename T>
+    std::enable_if_t<std::is_arithmetic<T>::value, SqlBuffer&> append_number(const T& val)
+    {
+        char buf[64];
+        auto res = std::to_chars(buf, buf + sizeof(buf), val);
+        str_.append(buf, res.ptr);
+        return *this;
+    }
+
+    /// Appends a value as a SQL literal: numbers as is, strings and time points quoted.
+    SqlBuffer& append_value(const std::string& val) { return append_literal(val); }
+    SqlBuffer& append_value(const time_point_t& val)
+    {
+        str_ += '\'';
+        append_ISO_8601(str_, val);
+        str_ += '\'';
+        return *this;
+    }
+    SqlBuffer& append_value(bool val) { return append(val ? "TRUE" : "FALSE"); }
+    template <typename T>
+    std::enable_if_t<std::is_arithmetic<T>::value, SqlBuffer&> append_value(const T& val)
+    {
+        return append_number(val);
+    }
+
+    /// Appends a value as a SQL expression: numbers as is, strings as raw SQL (e.g. "NOW()" or "'text'"),
+    /// anything else through its operator<<.
+    template <typename T>
+    SqlBuffer& append_sql(const T& val)
+    {
+        if constexpr (std::is_arithmetic<T>::value)
+            return append_number(val);
+        else if constexpr (std::is_convertible<const T&, std::string_view>::value)
+            return append(std::string_view(val));
+        else
+        {
+            std::ostringstream ss;
+            ss << val;
+            return append(ss.str());
+        }
+    }
+
+private:
+    static std::size_t& depth()
+    {
+        thread_local std::size_t depth = 0;
+        return depth;
+    }
+
+    static std::vector<std::unique_ptr<SqlBuffer>>& pool()
+    {
+        thread_local std::vector<std::unique_ptr<SqlBuffer>> buffers;
+        return buffers;
+    }
+
+    std::string str_;
+};
+
+/**
+ * Appends the quoted keys of a map but the shadowed ones, each followed by ", ".
+ */
+template <typename T>
+void append_identifiers(SqlBuffer& buf, const std::map<std::string, T>& map, const ShadowedKeys& shadowed)
+{
+    for (auto const& [key, val] : map)
+        if (!shadowed.contains(key))
+            buf.append_identifier(key).append(", ");
+}
+
+/**
+ * Appends the values of a map<std::string, T> but the shadowed ones as SQL literals, each followed by ", ".
+ */
+template <typename T>
+void append_values(SqlBuffer& buf, const std::map<std::string, T>& map, const ShadowedKeys& shadowed)
+{
+    for (auto const& [key, val] : map)
+        if (!shadowed.contains(key))
+            buf.append_value(val).append(", ");
+}
+
+/**
+ * Appends the i-th element of every column of a map<std::string, std::vector<T>> but the shadowed ones, each
+ * followed by ", ".
+ */
+template <typename T>
+void append_values_row(SqlBuffer& buf,
+    const std::map<std::string, std::vector<T>>& columns,
+    std::size_t i,
+    const ShadowedKeys& shadowed)
+{
+    for (auto const& [key, val_vec] : columns)
+        if (!shadowed.contains(key))
+            buf.append_value(val_vec[i]).append(", ");
+}
+
+/**
+ * Appends "key"=value assignments of a map<std::string, T> but the shadowed keys, each followed by ", ".
+ */
+template <typename T>
+void append_assignments(SqlBuffer& buf, const std::map<std::string, T>& map, const ShadowedKeys& shadowed)
+{
+    for (auto const& [key, val] : map)
+        if (!shadowed.contains(key))
+            buf.append_identifier(key).append('=').append_value(val).append(", ");
+}
+
+}  // namespace utl
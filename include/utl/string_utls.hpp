@@ -2,6 +2,7 @@
 #include <string>
 #include <iostream>
 #include <memory>
+#include <vector>
 #include "datetime.hpp"
 
 namespace utl {
@@ -76,7 +77,39 @@ std::vector<std::string> convert_to_string(const std::vector<T>& vals)
     return out;
 }
 
-std::string truncate(std::string str, size_t width, bool show_ellipsis = false)
+/**
+ * Quotes a string as a SQL literal, doubling its single quotes.
+ */
+inline std::string quote_literal(const std::string& str)
+{
+    std::string out = "'";
+    for (char c : str)
+    {
+        if (c == '\'')
+            out += '\'';
+        out += c;
+    }
+    out += '\'';
+    return out;
+}
+
+/**
+ * Formats strings as a SQL text[] literal: ARRAY['a', 'b']::text[].
+ */
+inline std::string text_array_literal(const std::vector<std::string>& strs)
+{
+    std::string out = "ARRAY[";
+    for (size_t i = 0; i < strs.size(); i++)
+    {
+        if (i > 0)
+            out += ", ";
+        out += quote_literal(strs[i]);
+    }
+    out += "]::text[]";
+    return out;
+}
+
+inline std::string truncate(std::string str, size_t width, bool show_ellipsis = false)
 {
     if (str.length() > width)
     {